@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "tilde.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#define DEFAULT_MB   (16)
+#define DEFAULT_RUNS (5)
+#define MAX_DEPTH    (24)  // of the nesting of the punctuation mix
+
+/*
+ * Throughput of the lexer alone, on corpora of one kind of text each.
+ * A corpus is made by a fixed pseudo random sequence, so that the
+ * same options always give the same text, and is mapped from a file
+ * like any source; only the loop over next_lexeme() is timed, and the
+ * best of several runs is reported.
+ *
+ * Allocations are counted by wrapping malloc() and friends at link
+ * time, see the bench-lex target. Cycles are those of the time stamp
+ * counter, which ticks at a fixed rate on current x86. The symbols
+ * and literals are freed before each run, so that no run finds the
+ * spellings of an earlier one already interned.
+ * With -k tokens are made by next_token() and freed at once, the way a
+ * parser does, and the hit rate of the token pool is reported too.
+ */
+typedef struct
+{
+    char *p;
+    size_t len;
+    size_t size;
+} Buffer;
+
+typedef struct
+{
+    const char *name;
+    void (*generate)(Buffer *b);
+} Mix;
+
+static unsigned long long seed;
+static unsigned long allocs;
+static bool use_tokens;  /* time next_token() rather than next_lexeme() */
+
+static void gen_ident(Buffer *b);
+static void gen_comment(Buffer *b);
+static void gen_literal(Buffer *b);
+static void gen_punct(Buffer *b);
+static void gen_mixed(Buffer *b);
+
+static const Mix mixes[] =
+{
+    { "ident",   gen_ident },
+    { "comment", gen_comment },
+    { "literal", gen_literal },
+    { "punct",   gen_punct },
+    { "mixed",   gen_mixed },
+};
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) { allocs++; return __real_malloc(size); }
+void *__wrap_calloc(size_t n, size_t size) { allocs++; return __real_calloc(n, size); }
+void *__wrap_realloc(void *ptr, size_t size) { allocs++; return __real_realloc(ptr, size); }
+
+/* xorshift64* */
+static unsigned int
+random_below(unsigned int n)
+{
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return (unsigned int)((seed * 2685821657736338717ull) >> 32) % n;
+}
+
+static void
+emit(Buffer *b, const char *s)
+{
+    size_t len = strlen(s);
+
+    if (b->len + len >= b->size)
+    {
+        while (b->len + len >= b->size) b->size *= 2;
+        b->p = (char*)try_realloc(b->p, b->size);
+    }
+    memcpy(b->p + b->len, s, len);
+    b->len += len;
+}
+
+static void
+emit_ident(Buffer *b)
+{
+    static const char *words[] =
+    {
+        "i", "n", "len", "count", "buffer", "next", "value", "node", "tmp",
+        "parse_expression", "lookahead_token", "symbol_table_entry",
+    };
+    char s[16];
+
+    emit(b, words[random_below(sizeof(words) / sizeof(words[0]))]);
+    if (random_below(2) == 0)
+    {
+        sprintf(s, "%u", random_below(100));
+        emit(b, s);
+    }
+}
+
+static void
+gen_ident(Buffer *b)
+{
+    static const char *types[] = { "int", "char", "long", "unsigned int", "double", "struct node *" };
+    static const char *ops[] = { " + ", " - ", " * ", " == ", " && ", " = ", " < " };
+    int i, n = 1 + random_below(6);
+
+    emit(b, types[random_below(sizeof(types) / sizeof(types[0]))]);
+    emit(b, " ");
+    emit_ident(b);
+    emit(b, " = ");
+    for (i = 0; i < n; i++)
+    {
+        if (i > 0) emit(b, ops[random_below(sizeof(ops) / sizeof(ops[0]))]);
+        emit_ident(b);
+    }
+    emit(b, ";\n");
+}
+
+static void
+gen_comment(Buffer *b)
+{
+    static const char *words[] = { "the", "lexer", "skips", "all", "of", "this", "text", "*", "/", "**" };
+    int i, n = 4 + random_below(40);
+
+    if (random_below(2) == 0)
+    {
+        emit(b, "/*");
+        for (i = 0; i < n; i++)
+        {
+            emit(b, (random_below(8) == 0) ? "\n * " : " ");
+            emit(b, words[random_below(sizeof(words) / sizeof(words[0]))]);
+        }
+        emit(b, " */\n");
+    }
+    else
+    {
+        emit(b, "//");
+        for (i = 0; i < n; i++)
+        {
+            emit(b, " ");
+            emit(b, words[random_below(sizeof(words) / sizeof(words[0]))]);
+        }
+        emit(b, "\n");
+    }
+    if (random_below(4) == 0) emit(b, "x = 0;\n");
+}
+
+static void
+gen_literal(Buffer *b)
+{
+    static const char *suffixes[] = { "", "u", "l", "ul" };
+    static const char *strings[] = { "hello, world", "a\\tb\\n", "\\\"quoted\\\"", "", "%d %s\\n" };
+    char s[64];
+
+    emit(b, "x = ");
+    switch (random_below(7))
+    {
+    case 0:
+        sprintf(s, "%u%s", random_below(1000000), suffixes[random_below(4)]);
+        break;
+    case 1:
+        sprintf(s, "0x%X%s", random_below(0x7fffffff), suffixes[random_below(4)]);
+        break;
+    case 2:
+        sprintf(s, "%u.%ue%d", random_below(1000), random_below(1000000), (int)random_below(80) - 40);
+        break;
+    case 3:
+        sprintf(s, "%u.%u%s", random_below(100), random_below(100000), random_below(2) ? "f" : "");
+        break;
+    case 4:
+        sprintf(s, "0x%x.%xp%d", random_below(256), random_below(4096), (int)random_below(20) - 10);
+        break;
+    case 5:
+        sprintf(s, "'%c'", 'a' + random_below(26));
+        break;
+    default:
+        sprintf(s, "\"%s\"", strings[random_below(sizeof(strings) / sizeof(strings[0]))]);
+        break;
+    }
+    emit(b, s);
+    emit(b, ";\n");
+}
+
+static void
+gen_nested(Buffer *b, int depth)
+{
+    static const char *ops[] = { "+", "-", "*", "/", "%", "<<", ">>", "&", "|", "^", "==", "!=", "<=", ">=", "&&", "||" };
+    static const char *opens[] = { "(", "[", "{" };
+    static const char *closes[] = { ")", "]", "}" };
+    int k;
+
+    // mostly the left operand nests, so that a statement stays short
+    if (depth >= MAX_DEPTH || random_below(16) == 0)
+    {
+        emit(b, (random_below(2) == 0) ? "a" : "b->c");
+        return;
+    }
+    k = random_below(3);
+    emit(b, opens[k]);
+    gen_nested(b, depth + 1);
+    emit(b, ops[random_below(sizeof(ops) / sizeof(ops[0]))]);
+    if (random_below(4) == 0) emit(b, "!~");
+    if (random_below(8) == 0) gen_nested(b, depth + 1);
+    else emit(b, (random_below(2) == 0) ? "a" : "b->c");
+    emit(b, closes[k]);
+}
+
+static void
+gen_punct(Buffer *b)
+{
+    gen_nested(b, 0);
+    emit(b, ";\n");
+}
+
+static void
+gen_mixed(Buffer *b)
+{
+    switch (random_below(10))
+    {
+    case 0: case 1:           gen_comment(b); break;
+    case 2: case 3: case 4:   gen_literal(b); break;
+    case 5:                   gen_punct(b);   break;
+    default:                  gen_ident(b);   break;
+    }
+}
+
+/* Writes a corpus of about size bytes to f */
+static bool
+write_corpus(const Mix *mix, size_t size, const char *f)
+{
+    Buffer b;
+    FILE *fp;
+    bool ret;
+
+    b.size = size + 4096;
+    b.p = (char*)try_malloc(b.size);
+    b.len = 0;
+    seed = 0x9e3779b97f4a7c15ull;
+    while (b.len < size) mix->generate(&b);
+
+    fp = fopen(f, "wb");
+    if (fp == NULL)
+    {
+        perror(f);
+        free(b.p);
+        return false;
+    }
+    ret = fwrite(b.p, 1, b.len, fp) == b.len;
+    if (fclose(fp) != 0) ret = false;
+    free(b.p);
+    return ret;
+}
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned long long
+cycles()
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void
+bench(const Mix *mix, const char *f, int runs, int nthreads)
+{
+    Lexer *lexer;
+    TokenArray *a;
+    Token *tk;
+    Lexeme lx;
+    PoolStats st;
+    unsigned long tokens, nallocs = 0;
+    unsigned long long c, best_cycles = 0;
+    double t, best = 0;
+    size_t bytes = 0;
+    int r;
+
+    for (r = 0; r < runs; r++)
+    {
+        // every run interns into empty tables, as the first one does
+        free_symbols();
+        free_literals();
+        lexer = make_lexer(f);
+        if (lexer == NULL) exit(EXIT_FAILURE);
+        tokens = 0;
+        allocs = 0;
+        t = now();
+        c = cycles();
+        if (nthreads > 0)
+        {
+            a = lex_parallel(lexer, nthreads);
+            tokens = a->len - 1;
+            free_token_array(&a);
+        }
+        else if (use_tokens)
+        {
+            for (tk = next_token(lexer); tk->kind != TK_ENDFILE; tk = next_token(lexer))
+            {
+                tokens++;
+                free_token(&tk);
+            }
+        }
+        else
+        {
+            for (next_lexeme(lexer, &lx); lx.kind != TK_ENDFILE; next_lexeme(lexer, &lx))
+            {
+                tokens++;
+            }
+            bytes = lx.loc;
+        }
+        c = cycles() - c;
+        t = now() - t;
+        if (r == 0 || t < best)
+        {
+            best = t;
+            best_cycles = c;
+            nallocs = allocs;
+        }
+        token_pool_stats(lexer, &st);
+        free_lexer(&lexer);
+    }
+    if (bytes == 0)
+    {
+        FILE *fp = fopen(f, "rb");
+        if (fp != NULL && fseek(fp, 0, SEEK_END) == 0) bytes = ftell(fp);
+        if (fp != NULL) fclose(fp);
+    }
+
+    printf("%-8s %8.1f %9.1f %9.2f %11.4f", mix->name, bytes / 1e6,
+           bytes / 1e6 / best, tokens / 1e6 / best, (double)nallocs / (tokens ? tokens : 1));
+#ifdef HAVE_TSC
+    printf(" %9.2f\n", (double)best_cycles / (bytes ? bytes : 1));
+#else
+    printf(" %9s\n", "-");
+#endif
+    if (use_tokens && nthreads == 0)
+    {
+        printf("         pool: %lu tokens in %lu slabs, %.4f hits; %lu spellings, %.4f hits\n",
+               st.tokens, st.token_allocs, 1 - (double)st.token_allocs / (st.tokens ? st.tokens : 1),
+               st.strings, 1 - (double)st.string_allocs / (st.strings ? st.strings : 1));
+    }
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "%s [-m mix] [-s MB] [-r runs] [-t threads] [-k] [-o file]\n", prog);
+    fprintf(stderr, "  mixes: ident, comment, literal, punct, mixed (all by default)\n");
+    fprintf(stderr, "  -k makes tokens by next_token() and reports their pool\n");
+    fprintf(stderr, "  -o writes the corpus of the mix to file and exits\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *only = NULL, *out = NULL;
+    char tmp[] = "/tmp/bench-lex-XXXXXX";
+    size_t size = DEFAULT_MB * 1000000;
+    int runs = DEFAULT_RUNS, nthreads = 0, opt, fd;
+    size_t i;
+
+    while ((opt = getopt(argc, argv, "m:s:r:t:ko:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm': only = optarg; break;
+        case 's': size = (size_t)(atof(optarg) * 1000000); break;
+        case 'r': runs = atoi(optarg); break;
+        case 't': nthreads = atoi(optarg); break;
+        case 'k': use_tokens = true; break;
+        case 'o': out = optarg; break;
+        default:  usage(argv[0]);
+        }
+    }
+    if (runs < 1 || size == 0) usage(argv[0]);
+
+    if (out == NULL)
+    {
+        fd = mkstemp(tmp);
+        if (fd < 0)
+        {
+            perror("mkstemp");
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+        printf("%-8s %8s %9s %9s %11s %9s\n", "mix", "MB", "MB/s", "Mtok/s", "allocs/tok", "cycles/B");
+    }
+    for (i = 0; i < sizeof(mixes) / sizeof(mixes[0]); i++)
+    {
+        if (only != NULL && strcmp(only, mixes[i].name) != 0) continue;
+        if (out != NULL)
+        {
+            if (!write_corpus(&mixes[i], size, out)) exit(EXIT_FAILURE);
+            return EXIT_SUCCESS;
+        }
+        if (!write_corpus(&mixes[i], size, tmp)) exit(EXIT_FAILURE);
+        bench(&mixes[i], tmp, runs, nthreads);
+    }
+    if (out == NULL) unlink(tmp);
+    return EXIT_SUCCESS;
+}
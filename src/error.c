@@ -4,19 +4,25 @@
 #include "tilde.h"
 
 void
-print_error(int row, int col, const char *f, ...)
+print_error(unsigned int row, unsigned int col, const char *f, ...)
 {
     va_list list;
-    fprintf(stderr, "\x1b[31mError:%d:%d: ", row, col);
+    va_start(list, f);
+    fprintf(stderr, "\x1b[31mError:%u:%u: ", row, col);
     vfprintf(stderr, f, list);
     fprintf(stderr, "\n\x1b[0m");
+    va_end(list);
 }
 
 void
-exit_error(int row, int col, const char *f, ...)
+exit_error(unsigned int row, unsigned int col, const char *f, ...)
 {
     va_list list;
-    print_error(row, col, f, list);
+    va_start(list, f);
+    fprintf(stderr, "\x1b[31mError:%u:%u: ", row, col);
+    vfprintf(stderr, f, list);
+    fprintf(stderr, "\n\x1b[0m");
+    va_end(list);
     exit(EXIT_FAILURE);
 }
 
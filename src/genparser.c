@@ -17,12 +17,13 @@ enum BNFKind
 typedef struct
 {
     enum BNFKind kind;
-    String *str;
+    Symbol sym;  // spelling, with the quotes of a TERM
+    String *str; // spelling to print
 } Factor;
 
 typedef struct
 {
-    List *rule; // List<Factor*>
+    Vec *rule; // Vec<Factor*>
     Factor *lookahed;
     // "dot" is a point of interest.
     // For example, if following LR1-term exist, 
@@ -34,12 +35,13 @@ typedef struct
     int dot;
 } LR1term;
 
-// Hashmap<char*,Factor*>
+static Lexer *lexer;
+// Hashmap<spelling of Symbol,Factor*>
 static Hashmap *hashmap;
 // All NON-TERM, TERM and END factors are stored.
 static Factor factor[RULE_SIZE];
 // Syntax
-static List *rules[RULE_SIZE];
+static Vec *rules[RULE_SIZE];
 
 static Factor start_rule;
 static Factor end_rule;
@@ -54,49 +56,50 @@ static void    print_rules();
 static Factor *find_initial_state();
 static void    liberator_void(void*);
 static void    calc_canonical_automaton();
-static List   *calc_closure(LR1term *term);
-static void    calc_closure_rec(List *set, LR1term *term);
-static LR1term*make_LR1term(List *rule, Factor *la, int d);
+static Vec    *calc_closure(LR1term *term);
+static void    calc_closure_rec(Vec *set, LR1term *term);
+static LR1term*make_LR1term(Vec *rule, Factor *la, int d);
 static Factor *get_dot_factor(const LR1term *term);
-static void    print_LR1set(List *set);
+static void    print_LR1set(Vec *set);
 
 static void
 parse()
 {
-    Token tk;
+    Token *tk;
     Factor *f;
 
     for (;;)
     {
-        next_token(&tk);
-        if (tk.kind == TK_IDENT)
+        tk = next_token(lexer);
+        if (tk->kind == TK_IDENT)
         {
             f = &factor[factor_idx];
             f->kind = NONTERM;
-            f->str = tk.str;
-            if (add_hashmap(hashmap, tk.str, f))
+            f->sym = tk->sym;
+            f->str = tk->str;
+            if (add_hashmap(hashmap, view_string(symbol_string(tk->sym)), f))
             {
                 factor_idx++;
             }
             else
             {
-                f = search_hashmap(hashmap, tk.str);
+                f = search_hashmap(hashmap, view_string(symbol_string(tk->sym)));
             }
         }
-        else if (tk.kind == TK_ENDFILE)
+        else if (tk->kind == TK_ENDFILE)
         {
             return;
         }
         else
         {
-            printf("Error:%d:%d: The beginning of the grammar rules must be an identifier.\n", tk.row, tk.col);
+            printf("Error:%u:%u: The beginning of the grammar rules must be an identifier.\n", tk->row, tk->col);
             exit(EXIT_FAILURE);
         }
 
-        next_token(&tk);
-        if (!(tk.kind == TK_PUNCTUATOR && tk.id == P_COLON))
+        tk = next_token(lexer);
+        if (!(tk->kind == TK_PUNCTUATOR && tk->id == P_COLON))
         {
-            printf("Error:%d:%d: Following the first non-terminal symbol of the grammar rules must be a colon.\n", tk.row, tk.col);
+            printf("Error:%u:%u: Following the first non-terminal symbol of the grammar rules must be a colon.\n", tk->row, tk->col);
             exit(EXIT_FAILURE);
         }
 
@@ -107,75 +110,78 @@ parse()
 static void
 parse2(Factor *lkeyword)
 {
-    Token tk;
+    Token *tk;
     Factor *f;
-    List *new_rule;
+    Vec *new_rule;
+    Symbol token = intern2("token");
 
-    new_rule = make_list();
-    add_list(new_rule, lkeyword);
+    new_rule = make_vec();
+    add_vec(new_rule, lkeyword);
     for (;;)
     {
-        next_token(&tk);
-        switch (tk.kind)
+        tk = next_token(lexer);
+        switch (tk->kind)
         {
         case TK_IDENT:
             f = &factor[factor_idx];
             f->kind = NONTERM;
-            f->str = tk.str;
-            if (add_hashmap(hashmap, tk.str, f))
+            f->sym = tk->sym;
+            f->str = tk->str;
+            if (add_hashmap(hashmap, view_string(symbol_string(tk->sym)), f))
             {
                 factor_idx++;
-                add_list(new_rule, f);
+                add_vec(new_rule, f);
             }
             else
             {
-                add_list(new_rule, search_hashmap(hashmap, tk.str));
+                add_vec(new_rule, search_hashmap(hashmap, view_string(symbol_string(tk->sym))));
             }
             break;
         case TK_STRING:
             f = &factor[factor_idx];
             f->kind = TERM;
-            f->str = tk.str;
-            if (add_hashmap(hashmap, tk.str, f))
+            f->sym = tk->sym;
+            f->str = tk->str;
+            if (add_hashmap(hashmap, view_string(symbol_string(tk->sym)), f))
             {
                 factor_idx++;
-                add_list(new_rule, f);
+                add_vec(new_rule, f);
             }
             else
             {
-                add_list(new_rule, search_hashmap(hashmap, tk.str));
+                add_vec(new_rule, search_hashmap(hashmap, view_string(symbol_string(tk->sym))));
             }
             break;
         case TK_PUNCTUATOR:
-            switch (tk.id)
+            switch (tk->id)
             {
                 case P_VBAR:
                     rules[rules_idx++] = new_rule;
-                    new_rule = make_list();
-                    add_list(new_rule, lkeyword);
+                    new_rule = make_vec();
+                    add_vec(new_rule, lkeyword);
                     break;
                 case P_SCOLON:
                     rules[rules_idx++] = new_rule;
                     return;
                 case P_PLUS:
-                    next_token(&tk);
-                    if (strcmp(tk.str->str, "token") == 0)
+                    tk = next_token(lexer);
+                    if (tk->sym == token)
                     {
-                        ((Factor*)at_list(new_rule, count_list(new_rule)-1))->kind = TERM;
+                        ((Factor*)at_vec(new_rule, new_rule->len-1))->kind = TERM;
                     }
                     else
                     {
-                        printf("Error:%d:%d: Invalid token option.\n", tk.row, tk.col);
+                        printf("Error:%u:%u: Invalid token option.\n", tk->row, tk->col);
                         exit(EXIT_FAILURE);
                     }
                     break;
                 default:
-                    printf("Error:%d:%d: Invalid punctuator token.\n", tk.row, tk.col);
+                    printf("Error:%u:%u: Invalid punctuator token.\n", tk->row, tk->col);
                     exit(EXIT_FAILURE);
             }
             break;
         default:
-            printf("Error:%d:%d: Invalid token.\n", tk.row, tk.col);
+            printf("Error:%u:%u: Invalid token.\n", tk->row, tk->col);
             exit(EXIT_FAILURE);
         }
     }
@@ -184,33 +190,37 @@ parse2(Factor *lkeyword)
 static void
 print_rules()
 {
-    iter_list iter;
+    StrBuilder *b = make_builder();
+    iter_vec iter;
     Factor *f;
     int i;
 
     for (i = 0; rules[i] != NULL; ++i)
     {
-        init_iter_list(rules[i], &iter);
-        printf("%3d:%s : ", i, ((Factor*)value_iter_list(&iter))->str->str);
-        next_iter_list(&iter);
-        for ( ; hasnext_iter_list(&iter); next_iter_list(&iter))
+        init_iter_vec(rules[i], &iter);
+        format_builder(b, "%3d:%s : ", i, ((Factor*)value_iter_vec(&iter))->str->str);
+        next_iter_vec(&iter);
+        for ( ; hasnext_iter_vec(&iter); next_iter_vec(&iter))
         {
-            f = (Factor*)value_iter_list(&iter);
-            printf("%s(%s) ", f->str->str, f->kind == TERM ? "TERM" : "NONTERM");
+            f = (Factor*)value_iter_vec(&iter);
+            format_builder(b, "%s(%s) ", f->str->str, f->kind == TERM ? "TERM" : "NONTERM");
         }
-        printf("\n");
+        append2_builder(b, '\n');
     }
+    fflush(stdout);
+    flush_builder(b, fileno(stdout));
+    free_builder(&b);
 }
 
 static Factor *
 find_initial_state()
 {
     Hashmap *hash;
-    iter_list iter;
+    iter_vec iter;
     Factor *f;
     char temp_flag[RULE_SIZE];
     int temp_flag_idx, i, ret;
-    String *left;
+    Symbol left;
 
     hash = make_hashmap(RULE_SIZE*2);
     temp_flag_idx = 0;
@@ -222,7 +232,7 @@ find_initial_state()
         if (f->kind == NONTERM)
         {
             temp_flag[temp_flag_idx] = 0;
-            add_hashmap(hash, f->str, temp_flag+temp_flag_idx);
+            add_hashmap(hash, view_string(symbol_string(f->sym)), temp_flag+temp_flag_idx);
         }
         else
         {
@@ -233,15 +243,15 @@ find_initial_state()
 
     for (i = 0; rules[i] != NULL; ++i)
     {
-        init_iter_list(rules[i], &iter);
-        left = ((Factor*)value_iter_list(&iter))->str;
-        next_iter_list(&iter);
-        for (; hasnext_iter_list(&iter); next_iter_list(&iter))
+        init_iter_vec(rules[i], &iter);
+        left = ((Factor*)value_iter_vec(&iter))->sym;
+        next_iter_vec(&iter);
+        for (; hasnext_iter_vec(&iter); next_iter_vec(&iter))
         {
-            f = (Factor*)value_iter_list(&iter);
-            if (f->kind == NONTERM && strcmp(f->str->str, left->str) != 0)
+            f = (Factor*)value_iter_vec(&iter);
+            if (f->kind == NONTERM && f->sym != left)
             {
-                *((char*)search_hashmap(hash, f->str)) = 1;
+                *((char*)search_hashmap(hash, view_string(symbol_string(f->sym)))) = 1;
             }
         }
     }
@@ -251,7 +261,7 @@ find_initial_state()
         f = factor+i;
         if (f->kind == NONTERM)
         {
-            if (*((char*)search_hashmap(hash, f->str)) == 0)
+            if (*((char*)search_hashmap(hash, view_string(symbol_string(f->sym)))) == 0)
             {
                 if (ret < 0)
                 {
@@ -282,14 +292,14 @@ static void
 calc_canonical_automaton()
 {
     Factor *initialstate = find_initial_state();
-    List *initrule;
+    Vec *initrule;
     LR1term *term;
 
     printf("\nInitial state: %s\n", initialstate->str->str);
 
-    initrule = make_list();
-    add_list(initrule, &start_rule);
-    add_list(initrule, initialstate);
+    initrule = make_vec();
+    add_vec(initrule, &start_rule);
+    add_vec(initrule, initialstate);
 
     term = make_LR1term(initrule, &end_rule, 0);
 
@@ -297,21 +307,21 @@ calc_canonical_automaton()
     print_LR1set(calc_closure(term));
 }
 
-// List<LR1term*>
-static List*
+// Vec<LR1term*>
+static Vec*
 calc_closure(LR1term *term)
 {
-    List *set;
+    Vec *set;
 
-    set = make_list();
-    add_list(set, term);
+    set = make_vec();
+    add_vec(set, term);
     calc_closure_rec(set, term);
 
     return set;
 }
 
 static void
-calc_closure_rec(List *set, LR1term *term)
+calc_closure_rec(Vec *set, LR1term *term)
 {
     Factor *lkeyword;
     Factor *dotfactor;
@@ -324,14 +334,14 @@ calc_closure_rec(List *set, LR1term *term)
 
     for (i = 0; rules[i] != NULL; ++i)
     {
-        lkeyword = (Factor*)at_list(rules[i], 0);
-        if (strcmp(lkeyword->str->str, dotfactor->str->str) == 0)
+        lkeyword = (Factor*)at_vec(rules[i], 0);
+        if (lkeyword->sym == dotfactor->sym)
         {
             new_lr1term = make_LR1term(rules[i], term->lookahed, term->dot);
-            add_list(set, new_lr1term);
+            add_vec(set, new_lr1term);
             new_dotfactor = get_dot_factor(new_lr1term);
-            if (new_dotfactor != NULL && strcmp(new_dotfactor->str->str,
-                       ((Factor*)at_list(new_lr1term->rule, 0))->str->str) != 0)
+            if (new_dotfactor != NULL &&
+                new_dotfactor->sym != ((Factor*)at_vec(new_lr1term->rule, 0))->sym)
             {
                 calc_closure_rec(set, new_lr1term);
             }
@@ -339,28 +349,28 @@ calc_closure_rec(List *set, LR1term *term)
     }
 }
 
-static List *
-calc_first_set(List *rule)
+static Vec *
+calc_first_set(Vec *rule)
 {
-    if (count_list(rule) == 1)
+    if (rule->len == 1)
     {
         return NULL;
     }
-    else if (((Factor*)at_list(rule, 1))->kind == TERM)
+    else if (((Factor*)at_vec(rule, 1))->kind == TERM)
     {
-        List *ret = make_list();
-        add_list(ret, at_list(rule, 1));
+        Vec *ret = make_vec();
+        add_vec(ret, at_vec(rule, 1));
         return ret;
     }
     else
     {
-        List *ret = make_list();
+        Vec *ret = make_vec();
         for (
     }
 }
 
 static LR1term *
-make_LR1term(List *rule, Factor *la, int d)
+make_LR1term(Vec *rule, Factor *la, int d)
 {
     LR1term *lr1term;
     
@@ -374,33 +384,37 @@ make_LR1term(List *rule, Factor *la, int d)
 static Factor *
 get_dot_factor(const LR1term *term)
 {
-    return (Factor*)at_list(term->rule, term->dot+1);
+    return (Factor*)at_vec(term->rule, term->dot+1);
 }
 
 static void
-print_LR1set(List *set)
+print_LR1set(Vec *set)
 {
-    iter_list iter, iter2;
+    StrBuilder *b = make_builder();
+    iter_vec iter, iter2;
     LR1term *term;
     int i;
     int dot;
 
-    for (init_iter_list(set, &iter);
-         hasnext_iter_list(&iter);
-         next_iter_list(&iter))
+    for (init_iter_vec(set, &iter);
+         hasnext_iter_vec(&iter);
+         next_iter_vec(&iter))
     {
-        term = (LR1term*)value_iter_list(&iter);
+        term = (LR1term*)value_iter_vec(&iter);
         
-        init_iter_list(term->rule, &iter2);
-        printf("[%s -> ", ((Factor*)value_iter_list(&iter2))->str->str);
-        next_iter_list(&iter2);
-        for (i = 0, dot = term->dot; hasnext_iter_list(&iter2); next_iter_list(&iter2), ++i)
+        init_iter_vec(term->rule, &iter2);
+        format_builder(b, "[%s -> ", ((Factor*)value_iter_vec(&iter2))->str->str);
+        next_iter_vec(&iter2);
+        for (i = 0, dot = term->dot; hasnext_iter_vec(&iter2); next_iter_vec(&iter2), ++i)
         {
-            if (i == dot) printf(" @ ");
-            printf("%s ", ((Factor*)value_iter_list(&iter2))->str->str);
+            if (i == dot) append3_builder(b, " @ ");
+            format_builder(b, "%s ", ((Factor*)value_iter_vec(&iter2))->str->str);
         }
-        printf(", %s]\n", term->lookahed->str->str);
+        format_builder(b, ", %s]\n", term->lookahed->str->str);
     }
+    fflush(stdout);
+    flush_builder(b, fileno(stdout));
+    free_builder(&b);
 }
 
 int
@@ -409,12 +423,15 @@ main(int argc, char *argv[])
     int i;
 
     if (argc != 2) exit(EXIT_FAILURE);
-    if (!open_file(argv[1], 1)) exit(EXIT_FAILURE);
+    lexer = make_lexer(argv[1]);
+    if (lexer == NULL) exit(EXIT_FAILURE);
 
     hashmap = make_hashmap(RULE_SIZE*2);
     start_rule.kind = NONTERM;
+    start_rule.sym = intern2("0S");
     start_rule.str = new2_string("0S");
     end_rule.kind = END;
+    end_rule.sym = intern2("$END");
     end_rule.str = new2_string("$END");
     for (i = 0; i < RULE_SIZE; ++i) rules[i] = NULL;
     factor_idx = 0;
@@ -3,32 +3,49 @@
 #include <string.h>
 #include "tilde.h"
 
+typedef unsigned int uint;
+
+/*
+ * Open addressing with linear probing over a power of 2 slots.
+ * The hash of every key is kept beside it, so most of the failed
+ * comparisons cost one integer compare. Removed keys leave a
+ * tombstone behind, which keeps the probe sequences of other keys
+ * intact until the next rehash.
+ */
 struct Hashmap
 {
     String **keys; // array of String*
     void **data;   // array of void*
+    uint *hashes;  // hash of each key
     int size;
     int amount_size;
+    int used;      // keys and tombstones
 };
 
-typedef unsigned int uint;
+static String tombstone;
+#define DELETED (&tombstone)
 
-static uint calc_hash(uint size, int c, const String *key);
+static int  find_slot(const Hashmap *hmap, StrView key, uint hash);
+static void insert(Hashmap *hmap, String *key, void *data, uint hash);
 static void rehash(Hashmap *hmap);
 
 Hashmap *
 make_hashmap(int size)
 {
     Hashmap *hmap;
+    int n;
 
     if (size <= 0) return NULL;
+    for (n = 8; n < size; n *= 2);
 
     hmap = (Hashmap*)try_malloc(sizeof(Hashmap));
-    hmap->keys = (String**)try_calloc(size, sizeof(String*));
-    hmap->data = (void**)try_calloc(size, sizeof(void*));
+    hmap->keys = (String**)try_calloc(n, sizeof(String*));
+    hmap->data = (void**)try_calloc(n, sizeof(void*));
+    hmap->hashes = (uint*)try_calloc(n, sizeof(uint));
 
-    hmap->size = size;
+    hmap->size = n;
     hmap->amount_size = 0;
+    hmap->used = 0;
     return hmap;
 }
 
@@ -39,131 +56,130 @@ free_hashmap(Hashmap **hmap, void (*liberator)(void*))
     int i;
     for (i = 0; i < hm->size; ++i)
     {
-        if (*(hm->keys+i) == NULL) continue;
+        if (*(hm->keys+i) == NULL || *(hm->keys+i) == DELETED) continue;
         free_string(hm->keys+i);
         liberator(*(hm->data+i));
     }
     free(hm->keys);
     free(hm->data);
+    free(hm->hashes);
     free(*hmap);
     *hmap = NULL;
 }
 
+/* Adds a copy of key; nothing is allocated if it is there already */
 bool
-add_hashmap(Hashmap *hmap, const String *key, void *data)
+add_hashmap(Hashmap *hmap, StrView key, void *data)
 {
-    unsigned int hash;
-    int i;
-
-    if (exists_hashmap(hmap, key)) return false;
-    if (hmap->amount_size > (int)(hmap->size*0.7)) rehash(hmap);
+    key.hash = hash_view(key);
+    if (find_slot(hmap, key, key.hash) >= 0) return false;
+    insert(hmap, new4_string(key), data, key.hash);
+    return true;
+}
 
-    for (i = 0; ; ++i)
-    {
-        hash = calc_hash(hmap->size, i, key);
-        if (*(hmap->keys+hash) == NULL)
-        {
-            *(hmap->keys+hash) = new_string(key);
-            *(hmap->data+hash) = data;
-            break;
-        }
-    }
+/* Like add_hashmap(), but key is taken over instead of copied */
+bool
+add2_hashmap(Hashmap *hmap, String *key, void *data)
+{
+    uint hash = hash_string(key);
 
-    hmap->amount_size++;
+    if (find_slot(hmap, view_string(key), hash) >= 0) return false;
+    insert(hmap, key, data, hash);
     return true;
 }
 
 bool
-remove_hashmap(Hashmap *hmap, const String *key, void (*liberator)(void*))
+remove_hashmap(Hashmap *hmap, StrView key, void (*liberator)(void*))
 {
-    uint hash;
-    int i;
+    int i = find_slot(hmap, key, hash_view(key));
 
-    for (i = 0; i < hmap->amount_size; ++i)
-    {
-        hash = calc_hash(hmap->size, i, key);
-        if (*(hmap->keys+hash) == NULL) return false;
-        if (cmp_string(*(hmap->keys+hash), key) == 0)
-        {
-            liberator(*(hmap->data+hash));
-            free_string(hmap->keys+hash);
-            *(hmap->keys+hash) = NULL;
-            *(hmap->data+hash) = NULL;
-            hmap->amount_size--;
-            return true;
-        }
-    }
-    return false;
+    if (i < 0) return false;
+    liberator(*(hmap->data+i));
+    free_string(hmap->keys+i);
+    *(hmap->keys+i) = DELETED;
+    *(hmap->data+i) = NULL;
+    hmap->amount_size--;
+    return true;
 }
 
 bool
-exists_hashmap(Hashmap *hmap, const String *key)
+exists_hashmap(Hashmap *hmap, StrView key)
 {
-    return search_hashmap(hmap, key) != NULL;
+    return find_slot(hmap, key, hash_view(key)) >= 0;
 }
 
 void *
-search_hashmap(Hashmap *hmap, const String *key)
+search_hashmap(Hashmap *hmap, StrView key)
 {
-    uint hash;
-    int i;
-    
-    for (i = 0; i < hmap->amount_size; ++i)
-    {
-        hash = calc_hash(hmap->size, i, key);
-        if (*(hmap->keys+hash) == NULL) return NULL;
-        if (cmp_string(*(hmap->keys+hash), key) == 0) return *(hmap->data+hash);
-    }
-    return NULL;
+    int i = find_slot(hmap, key, hash_view(key));
+    return (i < 0) ? NULL : *(hmap->data+i);
 }
 
-static uint
-calc_hash(uint size, int c, const String *key)
+/* index of the slot of key, or -1 */
+static int
+find_slot(const Hashmap *hmap, StrView key, uint hash)
 {
-    // FNV Hash
-    uint hash = 2166136261u;
-    int i, len = key->len;
+    uint mask = hmap->size - 1;
+    uint i;
+    String *k;
 
-    for (i = 0 ; i < len; ++i)
+    for (i = hash & mask; (k = *(hmap->keys+i)) != NULL; i = (i + 1) & mask)
     {
-        hash = (16777619u*hash) ^ (*key->str+i);
+        if (k == DELETED || *(hmap->hashes+i) != hash) continue;
+        if (eq_view(view_string(k), key)) return (int)i;
     }
-    return (hash+c) % size;
+    return -1;
 }
 
+static void
+insert(Hashmap *hmap, String *key, void *data, uint hash)
+{
+    uint mask, i;
+
+    if (hmap->used + 1 > hmap->size * 0.7) rehash(hmap);
+
+    mask = hmap->size - 1;
+    for (i = hash & mask; *(hmap->keys+i) != NULL && *(hmap->keys+i) != DELETED; i = (i + 1) & mask);
+    if (*(hmap->keys+i) == NULL) hmap->used++;
+    *(hmap->keys+i) = key;
+    *(hmap->data+i) = data;
+    *(hmap->hashes+i) = hash;
+    hmap->amount_size++;
+}
+
+/* Grows the table, or only sweeps the tombstones if they fill it */
 static void
 rehash(Hashmap *hmap)
 {
-    uint hash;
-    int i, j;
-    int new_size;
+    uint mask, j;
+    int i, new_size;
     String **new_keys;
     void **new_data;
+    uint *new_hashes;
 
-    new_size = hmap->size * 2;
+    new_size = (hmap->amount_size + 1 > hmap->size / 2) ? hmap->size * 2 : hmap->size;
     new_keys = (String**)try_calloc(new_size, sizeof(String*));
     new_data = (void**)try_calloc(new_size, sizeof(void*));
+    new_hashes = (uint*)try_calloc(new_size, sizeof(uint));
 
+    mask = new_size - 1;
     for (i = 0; i < hmap->size; ++i)
     {
-        if (*(hmap->keys+i) == NULL) continue;
-        for (j = 0; ; ++j)
-        {
-            hash = calc_hash(new_size, j, *(hmap->keys+i));
-            if (*(new_keys+hash) == NULL)
-            {
-                *(new_keys+hash) = *(hmap->keys+i);
-                *(new_data+hash) = *(hmap->data+i);
-                break;
-            }
-        }
+        if (*(hmap->keys+i) == NULL || *(hmap->keys+i) == DELETED) continue;
+        for (j = *(hmap->hashes+i) & mask; *(new_keys+j) != NULL; j = (j + 1) & mask);
+        *(new_keys+j) = *(hmap->keys+i);
+        *(new_data+j) = *(hmap->data+i);
+        *(new_hashes+j) = *(hmap->hashes+i);
     }
 
     free(hmap->keys);
     free(hmap->data);
+    free(hmap->hashes);
     hmap->size = new_size;
+    hmap->used = hmap->amount_size;
     hmap->keys = new_keys;
     hmap->data = new_data;
+    hmap->hashes = new_hashes;
 }
 
 #ifdef TEST_HASHMAP
@@ -173,12 +189,12 @@ debug_print(const Hashmap *hmap)
     int i;
     for (i = 0; i < hmap->size; ++i)
     {
-        if (*(hmap->keys+i) != NULL)
+        if (*(hmap->keys+i) != NULL && *(hmap->keys+i) != DELETED)
         {
-            printf("key=%s, val=%d, hash=%d\n",
+            printf("key=%s, val=%d, hash=%u\n",
                     (*(hmap->keys+i))->str,
                     *(int*)(*(hmap->data+i)),
-                    calc_hash(hmap->size, 0, *(hmap->keys+i)));
+                    *(hmap->hashes+i) & (hmap->size - 1));
         }
     }
 }
@@ -217,14 +233,14 @@ main(int argc, char *argv[])
             valp = (int*)malloc(sizeof(int));
             *valp = atoi(buf);
             printf("Add to hashmap (%s, %d)\n", key, *valp);
-            add_hashmap(map, new2_string(key), valp) ? puts("Success") : puts("Failed");
+            add_hashmap(map, view2_string(key), valp) ? puts("Success") : puts("Failed");
         }
         else if (strncmp(buf, "del", 3) == 0)
         {
             printf("key: "); fgets(key, BUFSIZE, stdin);
             key[strlen(key)-1] = '\0';
             printf("Delete from hashmap (%s)\n", key);
-            remove_hashmap(map, new2_string(key), liberator_int) ? puts("Success") : puts("Failed");
+            remove_hashmap(map, view2_string(key), liberator_int) ? puts("Success") : puts("Failed");
         }
         else if (strncmp(buf, "set", 3) == 0)
         {
@@ -233,7 +249,7 @@ main(int argc, char *argv[])
             printf("val: "); fgets(buf, BUFSIZE, stdin);
             val = atoi(buf);
             printf("Set new value to hashmap (%s, %d)\n", key, val);
-            valp = search_hashmap(map, new2_string(key));
+            valp = search_hashmap(map, view2_string(key));
             if (valp == NULL)
             {
                 puts("Failed");
@@ -249,7 +265,7 @@ main(int argc, char *argv[])
             printf("key: "); fgets(key, BUFSIZE, stdin);
             key[strlen(key)-1] = '\0';
             printf("Search from hashmap (%s)\n", key);
-            valp = search_hashmap(map, new2_string(key));
+            valp = search_hashmap(map, view2_string(key));
             if (valp == NULL)
             {
                 puts("Failed");
@@ -1,70 +1,326 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "tilde.h"
 
-#define STACK_SIZE (8)
+#define PARALLEL_MIN_CHUNK (256*1024) // smaller chunks are not worth a thread
+#define PRESCAN_WINDOW (4096)         // how far find_boundary() looks back
+#define TOKEN_BATCH (1024)
+#define TOK_VERSION (1)               // of the layout of .tok files
+#define STREAM_CHUNK (64*1024)        // text a stream must have ahead of a lexeme
+#define POOL_SLAB (256)               // tokens allocated at a time by next_token()
 
-static FILE *file = NULL;
-static int line, column;
+/*
+ * All the state of one lexer, so that any number of files can be
+ * lexed at the same time, e.g. one per thread.
+ *
+ * The whole source is held in one buffer of the source manager which
+ * is always terminated by a '\0' sentinel at end, followed by
+ * SCAN_PADDING readable bytes, so the scanner can walk a pointer
+ * without checking the length on every character.
+ * Lexemes only carry a location; lines and columns are left to the
+ * source manager.
+ * A lexer of a stream only holds a window of the source; the text of
+ * a lexeme stays there until the next one is lexed.
+ * The source must be UTF-8, and is checked a window at a time before
+ * it is lexed; identifiers may hold any letters of Unicode.
+ */
+struct Lexer
+{
+    SourceManager *sm;
+    bool own_sm;           /* sm was made for this lexer alone */
+    int id;                /* of the source in sm */
+    bool stream;           /* the source is read a window at a time */
+    bool eof;              /* the window reaches the end of the source */
+    const char *src;
+    const char *end;       /* the sentinel */
+    const char *cur;       /* next character to be read */
+    SrcLoc base;           /* location of src */
+    int errors;
+    bool quiet;            /* count errors without reporting them */
+    bool interning;        /* give identifiers and literals their symbols */
+    SrcLoc checked;        /* the text before is known to be UTF-8 */
+    Token endtoken;
+    struct PoolToken *free_tokens;
+    struct PoolSlab *slabs;
+    PoolStats stats;
+};
+
+/*
+ * Tokens are mostly freed soon after next_token() has made them, so a
+ * lexer keeps those of free_token() on a list to give them again, and
+ * a short spelling in the token itself; neither reaches malloc().
+ * The tokens of a lexer live until it is freed.
+ */
+typedef struct PoolToken
+{
+    Token token;
+    String str;
+    Lexer *lexer;           /* the pool of the token */
+    struct PoolToken *next; /* on the free list */
+} PoolToken;
+
+typedef struct PoolSlab
+{
+    struct PoolSlab *next;
+    PoolToken v[POOL_SLAB];
+} PoolSlab;
+
+/* A part of the source lexed by one thread of lex_parallel() */
+typedef struct
+{
+    Lexer lexer;
+    const char *start;
+    const char *limit;  /* lexemes from here on belong to the next chunk */
+    TokenArray *tokens;
+    Lexeme pending;     /* the first lexeme at or after limit */
+    bool pending_error;
+    int first;          /* tokens before first were lexed out of sync */
+    int last_error;     /* index of the last token with an error, or -1 */
+    pthread_t thread;
+} Chunk;
+
+/*
+ * A .tok file holds the lexemes of a source whose content had the hash
+ * and length of its header, followed by a table of the spellings of
+ * their symbols. Locations are offsets in the source and symbols are
+ * indexes in the table, as the numbers of both depend on the process.
+ */
+typedef struct
+{
+    char magic[4];
+    unsigned int version;
+    unsigned int lexeme_size;   /* a file of another build is not read */
+    unsigned int number_size;
+    unsigned long long hash;
+    unsigned long long srclen;
+    unsigned int ntokens;       /* lexemes which follow */
+    unsigned int nsymbols;      /* TokSymbols which follow them */
+} TokHeader;
+
+/* The first lexeme of a spelling, and the value if a constant */
+typedef struct
+{
+    unsigned int loc;
+    unsigned int len;
+    Number num;
+} TokSymbol;
+
+static const char *keywords[] =
+{
+    [KW_BOOL] = "bool",          [KW_BREAK] = "break",        [KW_CASE] = "case",
+    [KW_CHAR] = "char",          [KW_CONST] = "const",        [KW_CONTINUE] = "continue",
+    [KW_DEFAULT] = "default",    [KW_DO] = "do",              [KW_DOUBLE] = "double",
+    [KW_ELSE] = "else",          [KW_ENUM] = "enum",          [KW_EXTERN] = "extern",
+    [KW_FALSE] = "false",        [KW_FLOAT] = "float",        [KW_FOR] = "for",
+    [KW_GOTO] = "goto",          [KW_IF] = "if",              [KW_INLINE] = "inline",
+    [KW_INT] = "int",            [KW_LONG] = "long",          [KW_RETURN] = "return",
+    [KW_SHORT] = "short",        [KW_SIZEOF] = "sizeof",      [KW_STATIC] = "static",
+    [KW_STRUCT] = "struct",      [KW_SWITCH] = "switch",      [KW_TRUE] = "true",
+    [KW_TYPEDEF] = "typedef",    [KW_UCHAR] = "uchar",        [KW_UINT] = "uint",
+    [KW_ULONG] = "ulong",        [KW_UNION] = "union",        [KW_USHORT] = "ushort",
+    [KW_VOID] = "void",          [KW_VOLATILE] = "volatile",  [KW_WHILE] = "while",
+};
 
-static int char_stack[STACK_SIZE], sp;
+/*
+ * Perfect hash of the keywords, found by an offline search:
+ *   hash(s) = len + kw_asso[s[0]] + kw_asso[s[len-1]]
+ * is distinct for every keyword and less than KW_HASH_SIZE.
+ * Characters which never start or end a keyword map to
+ * KW_HASH_SIZE, so the hash of such a word is out of range.
+ */
+#define KW_MIN_LEN   (2)
+#define KW_MAX_LEN   (8)
+#define KW_HASH_SIZE (49)
 
-static char *keywords[] =
+static const unsigned char kw_asso[256] =
 {
-    "enum",   "break",   "return", "void",   "case",     "float",
-    "short",  "ushort",  "char",   "uchar",  "for",      "while",
-    "const",  "goto",    "sizeof", "bool",   "continue", "if",
-    "static", "default", "inline", "struct", "do",       "int",
-    "uint",   "switch",  "double", "long",   "ulong",    "typedef",
-    "else",   "union",   "extern", "true",   "false",    "volatile",
-    NULL,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49,  9, 10,  2, 22, 12, 12, 34, 10, 49, 12, 31, 16,  5, 30,
+    49, 49,  0,  1,  3, 18,  1, 16, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
+    49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49, 49,
 };
 
-static Token *endtoken = &(Token){.kind = TK_ENDFILE, .str = NULL};
+static const unsigned char kw_slot[KW_HASH_SIZE] =
+{
+    KW_INVALID,   KW_INVALID,   KW_INVALID,   KW_INVALID,
+    KW_INVALID,   KW_INVALID,   KW_INVALID,   KW_VOID,
+    KW_INVALID,   KW_SHORT,     KW_STRUCT,    KW_RETURN,
+    KW_DEFAULT,   KW_INVALID,   KW_CHAR,      KW_FOR,
+    KW_INT,       KW_STATIC,    KW_CONST,     KW_SIZEOF,
+    KW_FLOAT,     KW_INVALID,   KW_TYPEDEF,   KW_UCHAR,
+    KW_IF,        KW_UINT,      KW_BREAK,     KW_USHORT,
+    KW_UNION,     KW_TRUE,      KW_DOUBLE,    KW_VOLATILE,
+    KW_INVALID,   KW_EXTERN,    KW_DO,        KW_ULONG,
+    KW_CASE,      KW_INVALID,   KW_INLINE,    KW_FALSE,
+    KW_CONTINUE,  KW_SWITCH,    KW_ENUM,      KW_WHILE,
+    KW_BOOL,      KW_INVALID,   KW_GOTO,      KW_LONG,
+    KW_ELSE,
+};
 
 /* prototype */
-static bool make_ident(Token *tk, int c);
-static bool make_digit(Token *tk, int c);
-static bool make_digit_base(int c, int base, String *p);
-static bool make_float_base(int c, int base, String *p);
-static bool make_string_literal(Token *tk);
-static bool make_punctuator(Token *tk, int c);
-
-static bool estimate(int x);
+static bool make_ident(Lexer *lexer, Lexeme *lx, int c);
+static bool make_digit(Lexer *lexer, Lexeme *lx, int c);
+static bool make_digit_base(Lexer *lexer, int c, int base);
+static bool make_float_base(Lexer *lexer, int c, int base);
+static bool make_string_literal(Lexer *lexer, Lexeme *lx);
+static bool make_char_constant(Lexer *lexer, Lexeme *lx);
+static bool make_punctuator(Lexer *lexer, Lexeme *lx, int c);
+static void make_number(Lexer *lexer, const Lexeme *lx, const char *start);
+static void make_literal(const Lexeme *lx, const char *start);
+
+static bool estimate(Lexer *lexer, int x);
 static bool is_simple_escape(int c);
 static bool is_nondigit(int c);
 static bool is_digit(int c, int base);
-static bool is_space(int c);
 static bool is_return(int c);
 
-static void set_keyword(Token *tk);
-static void skip();
-static void pushback(int c);
-static int  nextchar();
+static enum KeywordID find_keyword(const char *s, int len);
+static void skip(Lexer *lexer);
+static void pushback(Lexer *lexer, int c);
+static int  nextchar(Lexer *lexer);
 
-bool
-open_file(const char *f)
+static void lex_error(Lexer *lexer, const char *at, const char *f, ...);
+static void *lex_chunk(void *arg);
+static const char *find_boundary(const char *p, const char *lo, const char *end);
+static void seek(Lexer *lexer, const Lexeme *lx);
+static void relex(Lexer *lexer, TokenArray *a);
+static bool has_symbol(const Lexeme *lx);
+static bool is_number(const Lexer *lexer, const Lexeme *lx);
+static void grow_token_array(TokenArray *a, int size);
+static Lexer *new_lexer(SourceManager *sm, int id);
+static void lex_lexeme(Lexer *lexer, Lexeme *lx);
+static void finish_lexeme(Lexer *lexer, Lexeme *lx);
+static void stream_lexeme(Lexer *lexer, Lexeme *lx);
+static void refill(Lexer *lexer, const char *keep);
+static int  find_lexeme(const Lexer *lexer, const TokenArray *a, size_t off, bool by_end);
+static unsigned long long hash_source(const char *p, size_t len);
+static bool write_all(int fd, const void *p, size_t len);
+static PoolToken *alloc_token(Lexer *lexer);
+static void check_window(Lexer *lexer);
+static void check_utf8(Lexer *lexer, const char *from, const char *to);
+static void check_text(Lexer *lexer, size_t off, size_t n);
+static int  xid_length(const Lexer *lexer, const char *p, bool first);
+static void invalid_char(Lexer *lexer, const char *start);
+static String *token_string(PoolToken *pt, const char *s, size_t len, bool nul);
+
+/* A lexer with a source manager of its own */
+Lexer *
+make_lexer(const char *f)
 {
-    file = fopen(f, "r");
-    if (file == NULL)
+    SourceManager *sm = make_source_manager();
+    Lexer *lexer = make2_lexer(sm, f);
+
+    if (lexer == NULL)
     {
-        perror("fopen");
-        return false;
+        free_source_manager(&sm);
+        return NULL;
     }
-    line = 1;
-    column = 0;
-    sp = 0;
-    return true;
+    lexer->own_sm = true;
+    return lexer;
+}
+
+/* A lexer of f, which is loaded into sm */
+Lexer *
+make2_lexer(SourceManager *sm, const char *f)
+{
+    Lexer *lexer;
+    int id = load_source(sm, f);
+
+    if (id < 0) return NULL;
+    lexer = new_lexer(sm, id);
+    check_window(lexer);
+    return lexer;
+}
+
+/*
+ * A lexer of the stream fd, e.g. a pipe, named name in sm. The memory
+ * it takes is bounded by the longest lexeme, however long the stream.
+ */
+Lexer *
+make3_lexer(SourceManager *sm, int fd, const char *name)
+{
+    Lexer *lexer;
+    int id = open_stream(sm, fd, name);
+
+    if (id < 0) return NULL;
+    lexer = new_lexer(sm, id);
+    lexer->stream = true;
+    lexer->eof = false;
+    check_window(lexer);
+    return lexer;
+}
+
+static Lexer *
+new_lexer(SourceManager *sm, int id)
+{
+    Lexer *lexer;
+    size_t len;
+
+    lexer = (Lexer*)try_malloc(sizeof(Lexer));
+    lexer->sm = sm;
+    lexer->own_sm = false;
+    lexer->id = id;
+    lexer->stream = false;
+    lexer->eof = true;
+    lexer->src = source_text(sm, id, &len, &lexer->base);
+    lexer->end = lexer->src + len;
+    lexer->cur = lexer->src;
+    lexer->errors = 0;
+    lexer->quiet = false;
+    lexer->interning = true;
+    lexer->checked = lexer->base;
+    lexer->endtoken.kind = TK_ENDFILE;
+    lexer->endtoken.id = P_INVALID;
+    lexer->endtoken.kw = KW_INVALID;
+    lexer->endtoken.str = NULL;
+    lexer->endtoken.sym = SYM_NONE;
+    lexer->free_tokens = NULL;
+    lexer->slabs = NULL;
+    memset(&lexer->stats, 0, sizeof(lexer->stats));
+    return lexer;
 }
 
+/* The text of the file stays in the source manager. */
 void
-close_file()
+free_lexer(Lexer **lexer)
 {
-    if (file == NULL) return;
-    if (fclose(file) != 0) perror("fclose");
-    file = NULL;
+    Lexer *p = *lexer;
+    PoolSlab *slab;
+    int i;
+
+    if (p == NULL) return;
+    while ((slab = p->slabs) != NULL)
+    {
+        for (i = 0; i < POOL_SLAB; i++)
+        {
+            if (slab->v[i].token.str != &slab->v[i].str) free_string(&slab->v[i].token.str);
+        }
+        p->slabs = slab->next;
+        free(slab);
+    }
+    if (p->own_sm) free_source_manager(&p->sm);
+    free(p);
+    *lexer = NULL;
 }
 
 void
@@ -86,10 +342,30 @@ print_token(const Token *tk)
     if (tk->kind == TK_PUNCTUATOR)   s = punctuator_to_string(tk->id);
     else if (tk->kind == TK_ENDFILE) s = "";
     else                             s = tk->str->str;
-    printf("%s (%d:%d)%s\n",
+    printf("%s (%u:%u)%s\n",
             p, tk->row, tk->col, s);
 }
 
+void
+print_lexeme(const Lexer *lexer, const Lexeme *lx)
+{
+    unsigned int row, col;
+    char *p;
+    switch (lx->kind)
+    {
+    case TK_IDENT:      p = "IDENT";      break;
+    case TK_KEYWORD:    p = "KEYWORD";    break;
+    case TK_CONSTANT:   p = "CONSTANT";   break;
+    case TK_STRING:     p = "STRING";     break;
+    case TK_PUNCTUATOR: p = "PUNCTUATOR"; break;
+    case TK_ENDFILE:    p = "ENDFILE";    break;
+    default:            p = "UNKNOWN";    break;
+    }
+    lexeme_position(lexer, lx, &row, &col);
+    printf("%s (%u:%u)%.*s\n",
+            p, row, col, (int)lx->len, lexeme_text(lexer, lx));
+}
+
 char *
 punctuator_to_string(enum PnctID p)
 {
@@ -145,266 +421,1003 @@ punctuator_to_string(enum PnctID p)
     }
 }
 
-Token *
-next_token()
+void
+next_lexeme(Lexer *lexer, Lexeme *lx)
 {
-    Token *token;
-    int c, d;
+    if (lexer->stream)
+    {
+        stream_lexeme(lexer, lx);
+        return;
+    }
+    lex_lexeme(lexer, lx);
+    finish_lexeme(lexer, lx);
+}
+
+/* Scans the next lexeme, all but its symbol */
+static void
+lex_lexeme(Lexer *lexer, Lexeme *lx)
+{
+    const char *start;
+    int c, n, errors;
 
-    skip();
-    token = (Token*)try_malloc(sizeof(Token));
-    c = nextchar();
+    skip(lexer);
+    start = lexer->cur;
+    c = nextchar(lexer);
 
-    token->kind = TK_INVALID;
-    token->id = P_INVALID;
-    token->row = line;
-    token->col = column;
-    token->str = NULL;
+    lx->kind = TK_INVALID;
+    lx->id = P_INVALID;
+    lx->kw = KW_INVALID;
+    lx->loc = lexer->base + (SrcLoc)(start - lexer->src);
 
     if (is_nondigit(c))
     {
-        make_ident(token, c);
-        return token;
+        make_ident(lexer, lx, c);
+    }
+    else if (c >= 0x80 && (n = xid_length(lexer, start, true)) > 0)
+    {
+        lexer->cur = start + n;
+        make_ident(lexer, lx, c);
     }
     else if (is_digit(c, 10))
     {
-        make_digit(token, c);
-        return token;
+        make_digit(lexer, lx, c);
     }
     else if (c == '"')
     {
-        make_string_literal(token);
-        return token;
+        make_string_literal(lexer, lx);
     }
     else if (c == '\'')
     {
-        token->kind = TK_CONSTANT;
-        token->str = make_string();
+        make_char_constant(lexer, lx);
+    }
+    else if (c == '.' && is_digit(*lexer->cur, 10))
+    {
+        lx->kind = TK_CONSTANT;
+        make_float_base(lexer, '.', 10);
+    }
+    else if (c == EOF)
+    {
+        lx->kind = TK_ENDFILE;
+    }
+    else
+    {
+        errors = lexer->errors;
+        if (!make_punctuator(lexer, lx, c) && lexer->errors == errors) invalid_char(lexer, start);
+    }
+    lx->len = (unsigned int)(lexer->cur - start);
+}
 
-        c = nextchar();
-        if (c == '\\')
+static void
+finish_lexeme(Lexer *lexer, Lexeme *lx)
+{
+    const char *start = lexeme_text(lexer, lx);
+
+    lx->sym = (lexer->interning && has_symbol(lx)) ? intern(start, lx->len) : SYM_NONE;
+    if (is_number(lexer, lx)) make_number(lexer, lx, start);
+    if (lx->kind == TK_STRING) make_literal(lx, start);
+}
+
+/*
+ * next_lexeme() of a stream. Unless the stream has ended, a chunk of
+ * text is read ahead of the lexeme, and a lexeme which reaches the end
+ * of the window anyway may go on past it: it is lexed quietly, and
+ * again with more text if it does. The errors of the lexeme are then
+ * reported by lexing it once more.
+ */
+static void
+stream_lexeme(Lexer *lexer, Lexeme *lx)
+{
+    const char *start;
+    int errors;
+    bool quiet = lexer->quiet, speculative;
+
+    if (!lexer->eof && lexer->end - lexer->cur < STREAM_CHUNK) refill(lexer, lexer->cur);
+    for (;;)
+    {
+        start = lexer->cur;
+        errors = lexer->errors;
+        speculative = !lexer->eof;
+        lexer->quiet = quiet || speculative;
+        lex_lexeme(lexer, lx);
+        lexer->quiet = quiet;
+        if (!speculative || lexer->cur < lexer->end) break;
+
+        // what was skipped before the lexeme is complete unless it reached the end too
+        lexer->errors = errors;
+        lexer->cur = (lx->kind != TK_ENDFILE) ? lexeme_text(lexer, lx) : start;
+        refill(lexer, lexer->cur);
+    }
+    if (speculative && lexer->errors != errors && !quiet)
+    {
+        lexer->errors = errors;
+        lexer->cur = start;
+        lex_lexeme(lexer, lx);
+    }
+    finish_lexeme(lexer, lx);
+}
+
+/* Moves the window of a stream to keep and reads more text */
+static void
+refill(Lexer *lexer, const char *keep)
+{
+    size_t len;
+
+    lexer->src = refill_source(lexer->sm, lexer->id, keep, &len, &lexer->base, &lexer->eof);
+    lexer->cur = lexer->src;
+    lexer->end = lexer->src + len;
+    check_window(lexer);
+}
+
+/*
+ * Checks the text of the window which has not been checked yet, but
+ * for a sequence cut by its end, which is left for the next window.
+ */
+static void
+check_window(Lexer *lexer)
+{
+    const char *from = lexer->src + (lexer->checked - lexer->base);
+    const char *to = lexer->end, *q;
+    int c;
+
+    if (!lexer->eof)
+    {
+        for (q = to; q > from && to - q < 3 && ((unsigned char)q[-1] & 0xc0) == 0x80; q--);
+        if (q > from)
         {
-            d = nextchar();
-            if (is_simple_escape(d))
+            c = (unsigned char)q[-1];
+            if ((c >= 0xc0 && to - q < 1) || (c >= 0xe0 && to - q < 2) || (c >= 0xf0 && to - q < 3))
             {
-                append2_string(token->str, '\\');
-                append2_string(token->str, d);
+                to = q - 1;
             }
-            else
+        }
+    }
+    check_utf8(lexer, from, to);
+    lexer->checked = lexer->base + (SrcLoc)(to - lexer->src);
+}
+
+/* Checks the n bytes at off, with the sequences which they are part of */
+static void
+check_text(Lexer *lexer, size_t off, size_t n)
+{
+    const char *from = lexer->src + off, *to = lexer->src + off + n;
+
+    for (; from > lexer->src && lexer->src + off - from < 3 && ((unsigned char)*from & 0xc0) == 0x80; from--);
+    for (; to < lexer->end && to - (lexer->src + off + n) < 3 && ((unsigned char)*to & 0xc0) == 0x80; to++);
+    check_utf8(lexer, from, to);
+}
+
+/* Reports each sequence between from and to which is not UTF-8 */
+static void
+check_utf8(Lexer *lexer, const char *from, const char *to)
+{
+    bool quiet = lexer->quiet;
+    size_t n;
+
+    // the text is checked only once, even by a speculative lexer
+    lexer->quiet = false;
+    for (;;)
+    {
+        n = validate_utf8(from, (size_t)(to - from));
+        if (from + n >= to) break;
+        lex_error(lexer, from + n, "Invalid UTF-8 sequence.");
+        for (from += n + 1; from < to && ((unsigned char)*from & 0xc0) == 0x80; from++);
+    }
+    lexer->quiet = quiet;
+}
+
+const char *
+lexeme_text(const Lexer *lexer, const Lexeme *lx) { return lexer->src + (lx->loc - lexer->base); }
+
+/* Finds the row and column of lx, which takes a search of the newlines */
+void
+lexeme_position(const Lexer *lexer, const Lexeme *lx, unsigned int *row, unsigned int *col)
+{
+    decode_loc(lexer->sm, lx->loc, row, col);
+}
+
+const char *
+keyword_to_string(enum KeywordID kw)
+{
+    if (kw == KW_INVALID) return "UNKNOWN";
+    return keywords[kw];
+}
+
+/* The token is lexer's until free_token(), and its spelling is not to be changed */
+Token *
+next_token(Lexer *lexer)
+{
+    Lexeme lx;
+    PoolToken *pt;
+    Token *token;
+    Literal lit;
+    const char *s, *p;
+    size_t len;
+
+    next_lexeme(lexer, &lx);
+    if (lx.kind == TK_ENDFILE)
+    {
+        lexeme_position(lexer, &lx, &lexer->endtoken.row, &lexer->endtoken.col);
+        return &lexer->endtoken;
+    }
+
+    pt = alloc_token(lexer);
+    token = &pt->token;
+    token->kind = lx.kind;
+    token->id = lx.id;
+    token->kw = lx.kw;
+    token->str = NULL;
+    token->sym = lx.sym;
+    lexeme_position(lexer, &lx, &token->row, &token->col);
+
+    s = lexeme_text(lexer, &lx);
+    if (lx.kind == TK_STRING && (lit = symbol_literal(lx.sym)) != LIT_NONE)
+    {
+        // the bytes of the literal with the terminating '\0', copied if they fit
+        // in the token and otherwise lent by the pool, so never to be changed
+        p = literal_bytes(lit, &len);
+        if (len + 1 < STRING_INLINE)
+        {
+            token->str = token_string(pt, p, len, true);
+        }
+        else
+        {
+            lexer->stats.strings++;
+            token->str = &pt->str;
+            token->str->str = (char*)p;
+            token->str->len = len + 1;
+            token->str->size = len + 1;
+            token->str->hash = 0;
+        }
+    }
+    else if (lx.kind == TK_STRING)
+    {
+        // without quotes, but with the terminating '\0'
+        token->str = token_string(pt, s+1, lx.len - (s[lx.len-1] == '"' ? 2 : 1), true);
+    }
+    else if (lx.kind == TK_CONSTANT && *s == '\'')
+    {
+        token->str = token_string(pt, s+1, lx.len - (s[lx.len-1] == '\'' ? 2 : 1), false);
+    }
+    else if (lx.kind != TK_PUNCTUATOR)
+    {
+        token->str = token_string(pt, s, lx.len, false);
+    }
+    return token;
+}
+
+/* Gives the token back to the pool of its lexer */
+void
+free_token(Token **tk)
+{
+    PoolToken *pt = (PoolToken*)*tk;
+
+    if ((*tk)->kind == TK_ENDFILE) return;
+    if (pt->token.str != &pt->str) free_string(&pt->token.str);
+    pt->token.str = NULL;
+    pt->lexer->stats.freed++;
+    pt->next = pt->lexer->free_tokens;
+    pt->lexer->free_tokens = pt;
+    *tk = NULL;
+}
+
+void
+token_pool_stats(const Lexer *lexer, PoolStats *st)
+{
+    *st = lexer->stats;
+}
+
+static PoolToken *
+alloc_token(Lexer *lexer)
+{
+    PoolSlab *slab;
+    PoolToken *pt;
+    int i;
+
+    lexer->stats.tokens++;
+    if (lexer->free_tokens == NULL)
+    {
+        slab = (PoolSlab*)try_malloc(sizeof(PoolSlab));
+        slab->next = lexer->slabs;
+        lexer->slabs = slab;
+        lexer->stats.token_allocs++;
+        for (i = POOL_SLAB - 1; i >= 0; i--)
+        {
+            slab->v[i].token.str = NULL;
+            slab->v[i].lexer = lexer;
+            slab->v[i].next = lexer->free_tokens;
+            lexer->free_tokens = &slab->v[i];
+        }
+    }
+    pt = lexer->free_tokens;
+    lexer->free_tokens = pt->next;
+    return pt;
+}
+
+/* The len bytes at s, followed by a '\0' of the spelling itself if nul */
+static String *
+token_string(PoolToken *pt, const char *s, size_t len, bool nul)
+{
+    String *str;
+
+    pt->lexer->stats.strings++;
+    if (len + nul < STRING_INLINE)
+    {
+        str = &pt->str;
+        str->str = str->buf;
+        str->size = STRING_INLINE;
+        str->hash = 0;
+        memcpy(str->str, s, len);
+        str->str[len] = '\0';
+        str->str[len + nul] = '\0';
+        str->len = len + nul;
+    }
+    else
+    {
+        pt->lexer->stats.string_allocs++;
+        str = make_string();
+        reserve_string(str, len + nul);
+        memcpy(str->str, s, len);
+        str->str[len] = '\0';
+        str->str[len + nul] = '\0';
+        str->len = len + nul;
+    }
+    return str;
+}
+
+TokenArray *
+make_token_array()
+{
+    TokenArray *a = (TokenArray*)try_malloc(sizeof(TokenArray));
+    a->len = 0;
+    a->size = 256;
+    a->v = (Lexeme*)try_malloc(sizeof(Lexeme) * a->size);
+    a->map = NULL;
+    a->mapsize = 0;
+    return a;
+}
+
+void
+free_token_array(TokenArray **a)
+{
+    if (*a == NULL) return;
+    if ((*a)->map != NULL)
+    {
+        if (munmap((*a)->map, (*a)->mapsize) != 0) perror("munmap");
+    }
+    else
+    {
+        free((*a)->v);
+    }
+    free(*a);
+    *a = NULL;
+}
+
+void
+add_token_array(TokenArray *a, const Lexeme *lx)
+{
+    if (a->len == a->size) grow_token_array(a, a->size * 2);
+    a->v[a->len++] = *lx;
+}
+
+/*
+ * Appends the next n lexemes to a, or less if TK_ENDFILE comes first,
+ * and returns how many were appended.
+ * A consumer can lex in batches by emptying a between the calls.
+ */
+int
+fill_token_array(Lexer *lexer, TokenArray *a, int n)
+{
+    Lexeme *lx;
+    int i;
+
+    if (a->size - a->len < n) grow_token_array(a, a->len + n);
+    for (i = 0, lx = a->v + a->len; i < n; )
+    {
+        next_lexeme(lexer, lx);
+        i++;
+        if (lx++->kind == TK_ENDFILE) break;
+    }
+    a->len += i;
+    return i;
+}
+
+/* Lexes the rest of the file at once */
+TokenArray *
+lex_all(Lexer *lexer)
+{
+    TokenArray *a = make_token_array();
+
+    while (a->len == 0 || a->v[a->len-1].kind != TK_ENDFILE)
+    {
+        fill_token_array(lexer, a, a->size);
+    }
+    return a;
+}
+
+/*
+ * Lexes the rest of the source on nthreads threads.
+ * The source is cut at newlines into chunks which are lexed on their
+ * own, assuming that they start outside of comments and literals.
+ * find_boundary() makes that likely, but only the lexer of the
+ * previous chunk knows for sure: it goes on past its limit until it
+ * reaches a lexeme which the next chunk has found too, and from there
+ * on both agree.
+ * Errors are reported in order by lexing again sequentially from the
+ * last lexeme before the first error; the first chunk reports its
+ * own. Symbols are given at the end in source order, so that they are
+ * numbered as next_lexeme() would do, and so are the values of the
+ * constants which have none yet. The result is always the same as
+ * that of next_lexeme().
+ */
+TokenArray *
+lex_parallel(Lexer *lexer, int nthreads)
+{
+    TokenArray *a;
+    Chunk *chunks;
+    Chunk *c, *d = NULL;
+    Lexeme lx;
+    Number num;
+    int n, i, j, k, errors;
+    bool bad;
+    size_t size = lexer->end - lexer->cur;
+
+    if (lexer->stream) return lex_all(lexer);
+    n = (nthreads < 1) ? 1 : nthreads;
+    if (size / PARALLEL_MIN_CHUNK < (size_t)n) n = (int)(size / PARALLEL_MIN_CHUNK);
+    if (n < 1) n = 1;
+
+    chunks = (Chunk*)try_malloc(sizeof(Chunk) * n);
+    chunks[0].start = lexer->cur;
+    for (k = 1; k < n; k++)
+    {
+        const char *p = lexer->cur + size / n * k;
+        if (p < chunks[k-1].start) p = chunks[k-1].start;
+        p = find_boundary(p, chunks[k-1].start, lexer->end);
+        if (p >= lexer->end) break;
+        chunks[k].start = p;
+    }
+    n = k;
+
+    for (k = 0; k < n; k++)
+    {
+        c = &chunks[k];
+        c->lexer = *lexer;
+        c->limit = (k + 1 < n) ? chunks[k+1].start : lexer->end;
+        c->lexer.interning = false;
+        c->tokens = make_token_array();
+        c->first = 0;
+        c->last_error = -1;
+        if (k > 0)
+        {
+            c->lexer.cur = c->start;
+            c->lexer.errors = 0;
+            c->lexer.quiet = true;
+            if (pthread_create(&c->thread, NULL, lex_chunk, c) != 0)
             {
-                print_error(line, column,
-                        "Invalid escape character \"%c\".", (char)d);
+                lex_chunk(c);
+                c->thread = pthread_self();
             }
         }
-        else
+    }
+    lex_chunk(&chunks[0]);
+
+    for (k = 1; k < n; k++)
+    {
+        if (!pthread_equal(chunks[k].thread, pthread_self()))
+        {
+            pthread_join(chunks[k].thread, NULL);
+        }
+    }
+
+    lexer->errors = chunks[0].lexer.errors;
+    a = make_token_array();
+    for (k = 0, j = 1; k < n; k++) j += chunks[k].tokens->len;
+    if (j > a->size) grow_token_array(a, j);
+    for (i = 0; ; )
+    {
+        c = &chunks[i];
+        if (c->lexer.quiet && c->last_error >= c->first)
         {
-            append2_string(token->str, c);
+            relex(lexer, a);
+            break;
         }
-        if (!estimate('\''))
+        for (j = c->first; j < c->tokens->len; j++)
+        {
+            add_token_array(a, &c->tokens->v[j]);
+        }
+
+        // go on until the lexemes of a following chunk are in sync
+        lx = c->pending;
+        bad = c->pending_error;
+        for (k = i + 1, j = 0; ; )
         {
-            // Between the new line or single quotes,
-            // I will skip the character
-            for (; !(is_return(c) || c == '\'' || c == EOF); c = nextchar());
-            print_error(token->row, token->col,
-                    "Single quotation is required.");
+            for (; k < n; k++, j = 0)
+            {
+                d = &chunks[k];
+                while (j < d->tokens->len && d->tokens->v[j].loc < lx.loc) j++;
+                if (j < d->tokens->len || d->pending.loc >= lx.loc) break;
+            }
+            if (k < n && lx.kind != TK_ENDFILE &&
+                lx.loc == ((j < d->tokens->len) ? d->tokens->v[j].loc : d->pending.loc))
+            {
+                break;
+            }
+            if (c->lexer.quiet && bad)
+            {
+                relex(lexer, a);
+                goto out;
+            }
+            add_token_array(a, &lx);
+            if (lx.kind == TK_ENDFILE) goto out;
+            errors = c->lexer.errors;
+            next_lexeme(&c->lexer, &lx);
+            bad = (c->lexer.errors != errors);
         }
-        return token;
+        i = k;
+        chunks[i].first = j;
     }
-    else if (c == '.')
+out:
+    for (j = 0; j < a->len; j++)
     {
-        d = nextchar();
-        if (is_digit(d, 10))
+        if (!has_symbol(&a->v[j])) continue;
+        a->v[j].sym = intern(lexeme_text(lexer, &a->v[j]), a->v[j].len);
+        if (is_number(lexer, &a->v[j]) && !symbol_number(a->v[j].sym, &num))
         {
-            pushback(d);
-            token->kind = TK_CONSTANT;
-            token->str = make_string();
-            make_float_base('.', 10, token->str);
-            return token;
+            decode_number(lexeme_text(lexer, &a->v[j]), a->v[j].len, &num);
+            set_symbol_number(a->v[j].sym, &num);
         }
-        else
+        if (a->v[j].kind == TK_STRING) make_literal(&a->v[j], lexeme_text(lexer, &a->v[j]));
+    }
+    lexer->cur = lexer->end;
+    for (k = 0; k < n; k++) free_token_array(&chunks[k].tokens);
+    free(chunks);
+    return a;
+}
+
+/*
+ * Writes a, all the lexemes of the source of lexer, to the .tok file f.
+ * A source with errors is not saved, as the errors would not be
+ * reported again. The file is replaced at once, so that a reader never
+ * sees it half written.
+ */
+bool
+save_token_array(const Lexer *lexer, const TokenArray *a, const char *f)
+{
+    TokHeader h;
+    TokSymbol *table;
+    Lexeme *v;
+    Number num;
+    Symbol max = SYM_NONE;
+    unsigned int *local;
+    char *tmp;
+    int fd, i;
+    bool ret;
+
+    if (lexer->stream || lexer->errors > 0 || a->len == 0 || a->v[a->len-1].kind != TK_ENDFILE)
+    {
+        return false;
+    }
+
+    // number the symbols of the source from 1 in order of appearance
+    for (i = 0; i < a->len; i++) if (a->v[i].sym > max) max = a->v[i].sym;
+    local = (unsigned int*)try_calloc((size_t)max + 1, sizeof(unsigned int));
+    // zeroed, and filled field by field, so that no padding reaches the
+    // file and the same source always gives the same bytes
+    table = (TokSymbol*)try_calloc((size_t)a->len + 1, sizeof(TokSymbol));
+    v = (Lexeme*)try_calloc((size_t)a->len, sizeof(Lexeme));
+    memset(&h, 0, sizeof(h));
+    for (i = 0; i < a->len; i++)
+    {
+        v[i].kind = a->v[i].kind;
+        v[i].id = a->v[i].id;
+        v[i].kw = a->v[i].kw;
+        v[i].loc = a->v[i].loc - lexer->base;
+        v[i].len = a->v[i].len;
+        v[i].sym = a->v[i].sym;
+        if (v[i].sym == SYM_NONE) continue;
+        if (local[v[i].sym] == 0)
         {
-            pushback(d);
+            table[h.nsymbols].loc = v[i].loc;
+            table[h.nsymbols].len = v[i].len;
+            if (symbol_number(v[i].sym, &num))
+            {
+                table[h.nsymbols].num.type = num.type;
+                table[h.nsymbols].num.i = num.i;
+            }
+            else table[h.nsymbols].num.type = NT_NONE;
+            local[v[i].sym] = ++h.nsymbols;
         }
+        v[i].sym = local[v[i].sym];
     }
-    else if (c == EOF)
+
+    memcpy(h.magic, "TTOK", 4);
+    h.version = TOK_VERSION;
+    h.lexeme_size = sizeof(Lexeme);
+    h.number_size = sizeof(Number);
+    h.srclen = lexer->end - lexer->src;
+    h.hash = hash_source(lexer->src, h.srclen);
+    h.ntokens = a->len;
+
+    tmp = (char*)try_malloc(strlen(f) + 32);
+    sprintf(tmp, "%s.%ld", f, (long)getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ret = fd >= 0 &&
+          write_all(fd, &h, sizeof(h)) &&
+          write_all(fd, v, sizeof(Lexeme) * h.ntokens) &&
+          write_all(fd, table, sizeof(TokSymbol) * h.nsymbols);
+    if (fd >= 0 && close(fd) != 0) ret = false;
+    if (ret && rename(tmp, f) != 0) ret = false;
+    if (!ret)
     {
-        endtoken->row = line;
-        endtoken->col = column;
-        free_token(&token);
-        return endtoken;
+        perror(f);
+        unlink(tmp);
     }
-    
-    if (make_punctuator(token, c))
+    free(tmp);
+    free(v);
+    free(table);
+    free(local);
+    return ret;
+}
+
+/*
+ * Loads the lexemes of the source of lexer from the .tok file f, as if
+ * lex_all() had been called. The lexemes stay in a private mapping of
+ * the file, whose locations and symbols are translated in place.
+ * NULL is returned if f does not exist or was not made from the
+ * current content of the source by this build.
+ */
+TokenArray *
+load_token_array(Lexer *lexer, const char *f)
+{
+    TokenArray *a;
+    TokHeader *h;
+    TokSymbol *table;
+    Lexeme *v;
+    Symbol *syms;
+    struct stat st;
+    size_t srclen = lexer->end - lexer->src;
+    char *map;
+    int fd;
+    unsigned int i;
+    bool bad = false;
+
+    if (lexer->stream || lexer->cur != lexer->src) return NULL;
+    fd = open(f, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TokHeader))
     {
-        return token;
+        close(fd);
+        return NULL;
     }
-    else
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    h = (TokHeader*)map;
+    v = (Lexeme*)(map + sizeof(TokHeader));
+    table = (TokSymbol*)(v + h->ntokens);
+    if (memcmp(h->magic, "TTOK", 4) != 0 || h->version != TOK_VERSION ||
+        h->lexeme_size != sizeof(Lexeme) || h->number_size != sizeof(Number) ||
+        h->srclen != srclen || h->ntokens == 0 ||
+        (size_t)st.st_size != sizeof(TokHeader) + sizeof(Lexeme) * h->ntokens
+                                                + sizeof(TokSymbol) * h->nsymbols ||
+        h->hash != hash_source(lexer->src, srclen))
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    // the spellings are interned once each, not once per lexeme
+    syms = (Symbol*)try_malloc(sizeof(Symbol) * (h->nsymbols + 1));
+    syms[0] = SYM_NONE;
+    for (i = 0; i < h->nsymbols && !bad; i++)
+    {
+        bad = (table[i].loc > srclen || table[i].len > srclen - table[i].loc);
+        if (bad) break;
+        syms[i+1] = intern(lexer->src + table[i].loc, table[i].len);
+        if (table[i].num.type != NT_NONE) set_symbol_number(syms[i+1], &table[i].num);
+        if (lexer->src[table[i].loc] == '"' && symbol_literal(syms[i+1]) == LIT_NONE)
+        {
+            set_symbol_literal(syms[i+1], decode_literal(lexer->src + table[i].loc, table[i].len));
+        }
+    }
+    for (i = 0; i < h->ntokens && !bad; i++)
+    {
+        bad = (v[i].loc > srclen || v[i].len > srclen - v[i].loc || v[i].sym > h->nsymbols);
+        if (bad) break;
+        v[i].loc += lexer->base;
+        v[i].sym = syms[v[i].sym];
+    }
+    free(syms);
+    if (bad || v[h->ntokens-1].kind != TK_ENDFILE)
     {
-        pushback(c);
+        munmap(map, st.st_size);
+        return NULL;
     }
 
-    exit(EXIT_FAILURE);
+    a = (TokenArray*)try_malloc(sizeof(TokenArray));
+    a->v = v;
+    a->len = a->size = h->ntokens;
+    a->map = map;
+    a->mapsize = st.st_size;
+    lexer->cur = lexer->end;
+    return a;
 }
 
-void
-free_token(Token **tk)
+/* Loads the lexemes from the .tok file f, or lexes and saves them there */
+TokenArray *
+lex_cached(Lexer *lexer, const char *f)
 {
-    if ((*tk)->kind == TK_ENDFILE) return;
-    free_string(&(*tk)->str);
-    free(*tk);
-    *tk = NULL;
+    TokenArray *a = load_token_array(lexer, f);
+
+    if (a == NULL)
+    {
+        a = lex_all(lexer);
+        save_token_array(lexer, a, f);
+    }
+    return a;
+}
+
+/*
+ * Replaces the len bytes at off of the source of lexer by the n bytes
+ * at text, and brings a, all the lexemes of the source, up to date.
+ * A lexeme only depends on the text from its beginning on, so lexing
+ * starts again after the lexemes which end before the edit, less one
+ * which may have seen it by looking two characters ahead. It stops as
+ * soon as a lexeme begins where one began before, past the edit: the
+ * lexemes from there on are the same, and only moved.
+ * If ed is not NULL, it is set to the lexemes which were replaced.
+ */
+bool
+edit_token_array(Lexer *lexer, TokenArray *a, size_t off, size_t len, const char *text, size_t n,
+                 TokenEdit *ed)
+{
+    TokenArray *b;
+    Lexeme lx;
+    SrcLoc oldbase = lexer->base, shift;
+    size_t size, restart;
+    int first, last, inserted, i;
+
+    if (a->len == 0 || a->v[a->len-1].kind != TK_ENDFILE) return false;
+    if (!edit_source(lexer->sm, lexer->id, off, len, text, n)) return false;
+
+    // the lexemes before first have not changed, and those from last on have only moved
+    first = find_lexeme(lexer, a, off, true);
+    if (first > 0) first--;
+    restart = (first > 0) ? a->v[first-1].loc - oldbase + a->v[first-1].len : 0;
+    last = find_lexeme(lexer, a, off + len, false);
+
+    lexer->src = source_text(lexer->sm, lexer->id, &size, &lexer->base);
+    lexer->end = lexer->src + size;
+    lexer->cur = lexer->src + restart;
+    check_text(lexer, off, n);
+    shift = lexer->base - oldbase + (SrcLoc)(n - len);
+
+    b = make_token_array();
+    for (;;)
+    {
+        next_lexeme(lexer, &lx);
+        while (last < a->len - 1 && a->v[last].loc + shift < lx.loc) last++;
+        if (a->v[last].loc + shift == lx.loc) break;
+        add_token_array(b, &lx);
+    }
+    lexer->cur = lexer->end;
+
+    inserted = b->len;
+    if (ed != NULL)
+    {
+        ed->first = first;
+        ed->removed = last - first;
+        ed->inserted = inserted;
+    }
+    size = (size_t)a->len - (last - first) + inserted;
+    if (size > (size_t)a->size) grow_token_array(a, (int)size);
+    memmove(a->v + first + inserted, a->v + last, sizeof(Lexeme) * (a->len - last));
+    memcpy(a->v + first, b->v, sizeof(Lexeme) * inserted);
+    a->len = (int)size;
+    free_token_array(&b);
+
+    if (lexer->base != oldbase)
+    {
+        for (i = 0; i < first; i++) a->v[i].loc += lexer->base - oldbase;
+    }
+    for (i = first + inserted; i < a->len; i++) a->v[i].loc += shift;
+    return true;
 }
 
 static bool
-make_ident(Token *tk, int c)
+make_ident(Lexer *lexer, Lexeme *lx, int c)
 {
-    String *ident = make_string();
-    tk->kind = TK_IDENT;
-    tk->row = line;
-    tk->col = column;
-    tk->str = ident;
-    for (; is_nondigit(c) || is_digit(c, 10); c = nextchar())
+    const char *start = lexeme_text(lexer, lx);
+    int n;
+
+    for (;;)
     {
-        append2_string(ident, c);
+        lexer->cur = skip_ident(lexer->cur);
+        if ((unsigned char)*lexer->cur < 0x80) break;
+        if ((n = xid_length(lexer, lexer->cur, false)) == 0) break;
+        lexer->cur += n;
     }
-    pushback(c);
-    set_keyword(tk);
+    lx->kw = find_keyword(start, (int)(lexer->cur - start));
+    lx->kind = (lx->kw == KW_INVALID) ? TK_IDENT : TK_KEYWORD;
     return true;
 }
 
+/*
+ * Returns the length of the character at p if it is of XID_Start, or
+ * of XID_Continue unless first, and 0 otherwise. A sequence cut by the
+ * end of the window of a stream is taken as far as it goes, so that
+ * the lexeme reaches the end and is lexed again with more text.
+ */
+static int
+xid_length(const Lexer *lexer, const char *p, bool first)
+{
+    unsigned int cp;
+    int n = decode_utf8(p, (size_t)(lexer->end - p), &cp);
+
+    if (n == 0 && !lexer->eof && lexer->end - p < 4) return (int)(lexer->end - p);
+    if (n == 0 || !(first ? is_xid_start(cp) : is_xid_continue(cp))) return 0;
+    return n;
+}
+
+/* Reports the character at start, which begins no lexeme, and passes it */
+static void
+invalid_char(Lexer *lexer, const char *start)
+{
+    unsigned int cp;
+    int n = decode_utf8(start, (size_t)(lexer->end - start), &cp);
+
+    if (n == 0)
+    {
+        // check_utf8() has reported it
+        lexer->errors++;
+        lexer->cur = start + 1;
+        if (!lexer->eof && lexer->end - start < 4) lexer->cur = lexer->end;
+        return;
+    }
+    lexer->cur = start + n;
+    if (cp > ' ' && cp < 0x7f)
+    {
+        lex_error(lexer, start, "Invalid character '%c'.", (char)cp);
+    }
+    else
+    {
+        lex_error(lexer, start, "Invalid character U+%04X.", cp);
+    }
+}
+
 static bool
-make_digit(Token *tk, int c)
+make_digit(Lexer *lexer, Lexeme *lx, int c)
 {
-    tk->kind = TK_CONSTANT;
-    tk->row = line;
-    tk->col = column;
-    tk->str = make_string();
+    lx->kind = TK_CONSTANT;
     if (c == '0')
     {
-        c = nextchar();
+        c = nextchar(lexer);
         if (c == 'x' || c == 'X')
         {
-            append3_string(tk->str, "0x");
-            return make_digit_base(nextchar(), 16, tk->str);
+            return make_digit_base(lexer, nextchar(lexer), 16);
         }
         else
         {
-            pushback(c);
+            pushback(lexer, c);
             c = '0';
         }
     }
-    return make_digit_base(c, 10, tk->str);
+    return make_digit_base(lexer, c, 10);
 }
 
 static bool
-make_digit_base(int c, int base, String *p)
+make_digit_base(Lexer *lexer, int c, int base)
 {
-    for (; is_digit(c, base); c = nextchar())
+    if (is_digit(c, base))
     {
-        append2_string(p, c);
+        lexer->cur = skip_digit(lexer->cur, base);
+        c = nextchar(lexer);
     }
 
     if (c == '.' || c == 'e' || c == 'E' || c == 'p' || c == 'P')
     {
-        return make_float_base(c, (base == 16) ? 16 : 10, p);
+        return make_float_base(lexer, c, (base == 16) ? 16 : 10);
     }
 
     if (c == 'u' || c == 'U' || c == 'l' || c == 'L')
     {
-        int d = nextchar();
-        append2_string(p, c);
-        if (((c == 'u' || c == 'U') && (d == 'l' || d == 'L')) ||
-            ((c == 'l' || c == 'L') && (d == 'u' || d == 'U')))
+        int d = nextchar(lexer);
+        if (!(((c == 'u' || c == 'U') && (d == 'l' || d == 'L')) ||
+              ((c == 'l' || c == 'L') && (d == 'u' || d == 'U'))))
         {
-            append2_string(p, d);
-        }
-        else
-        {
-            pushback(d);
+            pushback(lexer, d);
         }
     }
     else
     {
-        pushback(c);
+        pushback(lexer, c);
     }
     return true;
 }
 
 static bool
-make_float_base(int c, int base, String *p)
+make_float_base(Lexer *lexer, int c, int base)
 {
     if (c == '.')
     {
-        append2_string(p, c);
-        c = nextchar();
-        if (is_digit(c, base))
-        {
-            for (; is_digit(c, base); c = nextchar())
-            {
-                append2_string(p, c);
-            }
-        }
+        lexer->cur = skip_digit(lexer->cur, base);
+        c = nextchar(lexer);
     }
 
     if (c == 'e' || c == 'E' || c == 'p' || c == 'P')
     {
-        append2_string(p, c);
-        c = nextchar();
-        if (c == '+' || c == '-')
+        if (*lexer->cur == '+' || *lexer->cur == '-') lexer->cur++;
+        lexer->cur = skip_digit(lexer->cur, 10);
+        c = nextchar(lexer);
+    }
+
+    if (!(c == 'f' || c == 'F' || c == 'l' || c == 'L'))
+    {
+        pushback(lexer, c);
+    }
+    return true;
+}
+
+/* Decodes the integer or floating constant lx, whose spelling is at start */
+static void
+make_number(Lexer *lexer, const Lexeme *lx, const char *start)
+{
+    Number n;
+
+    switch (decode_number(start, lx->len, &n))
+    {
+    case NUM_OK:
+        break;
+    case NUM_RANGE:
+        if (n.type >= NT_FLOAT)
         {
-            append2_string(p, c);
-            c = nextchar();
+            lex_error(lexer, start, "Floating constant is out of range.");
         }
-        
-        for (; is_digit(c, 10); c = nextchar())
+        else
         {
-            append2_string(p, c);
+            lex_error(lexer, start, "Integer constant is too large.");
         }
+        break;
+    case NUM_MALFORMED:
+        lex_error(lexer, start, "Malformed constant, digits are missing.");
+        break;
     }
+    if (lx->sym != SYM_NONE) set_symbol_number(lx->sym, &n);
+}
 
-    if (c == 'f' || c == 'F' || c == 'l' || c == 'L')
-    {
-        append2_string(p, c);
-    }
-    else
+/* Decodes the string literal lx once for all the lexemes of its spelling */
+static void
+make_literal(const Lexeme *lx, const char *start)
+{
+    if (lx->sym != SYM_NONE && symbol_literal(lx->sym) == LIT_NONE)
     {
-        pushback(c);
+        set_symbol_literal(lx->sym, decode_literal(start, lx->len));
     }
-    return true;
 }
 
 static bool
-make_string_literal(Token *tk)
+make_string_literal(Lexer *lexer, Lexeme *lx)
 {
-    String *str;
     int c, d;
 
-    str = make_string();
-    tk->kind = TK_STRING;
-    tk->row = line;
-    tk->col = column;
-    tk->str = str;
-
+    lx->kind = TK_STRING;
     for (;;)
     {
-        c = nextchar();
-        if (c == '\n') return false;
-        if (c == '"')
+        c = nextchar(lexer);
+        if (c == '"') return true;
+        if (is_return(c) || c == EOF)
         {
-            append2_string(str, '\0');
-            return true;
+            pushback(lexer, c);
+            lex_error(lexer, lexeme_text(lexer, lx), "Double quotation is required.");
+            return false;
         }
-        append2_string(str, c);
         if (c == '\\')
         {
-            d = nextchar();
-            if (is_simple_escape(d))
-            {
-                append2_string(str, d);
-            }
-            else
+            d = nextchar(lexer);
+            if (!is_simple_escape(d))
             {
-                print_error(tk->row, tk->col,
+                lex_error(lexer, lexeme_text(lexer, lx),
                         "Invalid escape character \"%c\".", (char)d);
             }
         }
@@ -412,124 +1425,148 @@ make_string_literal(Token *tk)
 }
 
 static bool
-make_punctuator(Token *tk, int c)
+make_char_constant(Lexer *lexer, Lexeme *lx)
 {
-    tk->id = P_INVALID;
-    tk->row = line;
-    tk->col = column;
-    tk->str = NULL;
+    int c, d;
+
+    lx->kind = TK_CONSTANT;
+    c = nextchar(lexer);
+    if (c == '\\')
+    {
+        d = nextchar(lexer);
+        if (!is_simple_escape(d))
+        {
+            lex_error(lexer, lexer->cur - 1,
+                    "Invalid escape character \"%c\".", (char)d);
+        }
+    }
+    if (!estimate(lexer, '\''))
+    {
+        // Between the new line or single quotes,
+        // I will skip the character
+        for (; !(is_return(c) || c == '\'' || c == EOF); c = nextchar(lexer));
+        lex_error(lexer, lexeme_text(lexer, lx),
+                "Single quotation is required.");
+        return false;
+    }
+    return true;
+}
+
+static bool
+make_punctuator(Lexer *lexer, Lexeme *lx, int c)
+{
+    lx->id = P_INVALID;
     switch (c)
     {
-    case '[': tk->id = P_SQR_BRCK_L; break;
-    case ']': tk->id = P_SQR_BRCK_R; break;
-    case '(': tk->id = P_PAREN_L; break;
-    case ')': tk->id = P_PAREN_R; break;
-    case '{': tk->id = P_CRL_BRCK_L; break;
-    case '}': tk->id = P_CRL_BRCK_R; break;
+    case '[': lx->id = P_SQR_BRCK_L; break;
+    case ']': lx->id = P_SQR_BRCK_R; break;
+    case '(': lx->id = P_PAREN_L; break;
+    case ')': lx->id = P_PAREN_R; break;
+    case '{': lx->id = P_CRL_BRCK_L; break;
+    case '}': lx->id = P_CRL_BRCK_R; break;
     case '.':
-        if (estimate('.'))
+        if (estimate(lexer, '.'))
         {
-            if (estimate('.'))
+            if (estimate(lexer, '.'))
             {
-                tk->col--;
-                tk->id = P_TLEAD;
+                lx->id = P_TLEAD;
             }
             else
             {
-                print_error(line, column, "Probably, '...'");
+                lex_error(lexer, lexer->cur - 1, "Probably, '...'");
             }
         }
         else
         {
-            tk->id = P_DOT;
+            lx->id = P_DOT;
         }
         break;
-    case ',': tk->id = P_COMMA; break;
+    case ',': lx->id = P_COMMA; break;
     case '-':
-        c = nextchar();
-        if (c == '>')      tk->id = P_ARRW;
-        else if (c == '-') tk->id = P_MINS_MINS;
-        else if (c == '=') tk->id = P_ASGN_MINS;
+        c = nextchar(lexer);
+        if (c == '>')      lx->id = P_ARRW;
+        else if (c == '-') lx->id = P_MINS_MINS;
+        else if (c == '=') lx->id = P_ASGN_MINS;
         else
         {
-            tk->id = P_MINS;
-            pushback(c);
+            lx->id = P_MINS;
+            pushback(lexer, c);
         }
         break;
     case '+':
-        c = nextchar();
-        if (c == '+')      tk->id = P_PLUS_PLUS;
-        else if (c == '=') tk->id = P_ASGN_PLUS;
+        c = nextchar(lexer);
+        if (c == '+')      lx->id = P_PLUS_PLUS;
+        else if (c == '=') lx->id = P_ASGN_PLUS;
         else
         {
-            tk->id = P_PLUS;
-            pushback(c);
+            lx->id = P_PLUS;
+            pushback(lexer, c);
         }
         break;
     case '&':
-        c = nextchar();
-        if (c == '&')      tk->id = P_AMPD_AMPD;
-        else if (c == '=') tk->id = P_ASGN_AMPD;
+        c = nextchar(lexer);
+        if (c == '&')      lx->id = P_AMPD_AMPD;
+        else if (c == '=') lx->id = P_ASGN_AMPD;
         else
         {
-            tk->id = P_AMPD;
-            pushback(c);
+            lx->id = P_AMPD;
+            pushback(lexer, c);
         }
         break;
-    case '*': tk->id = estimate('=') ? P_ASGN_MULT : P_MULT; break;
-    case '~': tk->id = P_TILDE; break;
-    case '!': tk->id = estimate('=') ? P_NEQ       : P_EXCM; break;
-    case '/': tk->id = estimate('=') ? P_ASGN_DIV  : P_DIV;  break;
-    case '%': tk->id = estimate('=') ? P_ASGN_MOD  : P_MOD;  break;
+    case '*': lx->id = estimate(lexer, '=') ? P_ASGN_MULT : P_MULT; break;
+    case '~': lx->id = P_TILDE; break;
+    case '!': lx->id = estimate(lexer, '=') ? P_NEQ       : P_EXCM; break;
+    case '/': lx->id = estimate(lexer, '=') ? P_ASGN_DIV  : P_DIV;  break;
+    case '%': lx->id = estimate(lexer, '=') ? P_ASGN_MOD  : P_MOD;  break;
     case '<':
-        c = nextchar();
-        if (c == '<')      tk->id = estimate('=') ? P_ASGN_SHIFT_L : P_SHIFT_L;
-        else if (c == '=') tk->id = P_LESS_EQ;
+        c = nextchar(lexer);
+        if (c == '<')      lx->id = estimate(lexer, '=') ? P_ASGN_SHIFT_L : P_SHIFT_L;
+        else if (c == '=') lx->id = P_LESS_EQ;
         else
         {
-            tk->id = P_LESS;
-            pushback(c);
+            lx->id = P_LESS;
+            pushback(lexer, c);
         }
         break;
     case '>':
-        c = nextchar();
-        if (c == '>')      tk->id = estimate('=') ? P_ASGN_SHIFT_R : P_SHIFT_R;
-        else if (c == '=') tk->id = P_GRT_EQ;
+        c = nextchar(lexer);
+        if (c == '>')      lx->id = estimate(lexer, '=') ? P_ASGN_SHIFT_R : P_SHIFT_R;
+        else if (c == '=') lx->id = P_GRT_EQ;
         else
         {
-            tk->id = P_GRT;
-            pushback(c);
+            lx->id = P_GRT;
+            pushback(lexer, c);
         }
         break;
-    case '=': tk->id = estimate('=') ? P_EQ         : P_ASGN;  break;
-    case '^': tk->id = estimate('=') ? P_ASGN_CARET : P_CARET; break;
+    case '=': lx->id = estimate(lexer, '=') ? P_EQ         : P_ASGN;  break;
+    case '^': lx->id = estimate(lexer, '=') ? P_ASGN_CARET : P_CARET; break;
     case '|':
-        c = nextchar();
-        if (c == '|')      tk->id = P_VBAR_VBAR;
-        else if (c == '=') tk->id = P_ASGN_VBAR;
-        else               tk->id = P_VBAR;
+        c = nextchar(lexer);
+        if (c == '|')      lx->id = P_VBAR_VBAR;
+        else if (c == '=') lx->id = P_ASGN_VBAR;
+        else               lx->id = P_VBAR;
         break;
-    case '?': tk->id = P_QMARK;  break;
-    case ':': tk->id = P_COLON;  break;
-    case ';': tk->id = P_SCOLON; break;
+    case '?': lx->id = P_QMARK;  break;
+    case ':': lx->id = P_COLON;  break;
+    case ';': lx->id = P_SCOLON; break;
     }
 
-    if (tk->id == P_INVALID)
+    if (lx->id == P_INVALID)
     {
         return false;
     }
     else
     {
-        tk->kind = TK_PUNCTUATOR;
+        lx->kind = TK_PUNCTUATOR;
         return true;
     }
 }
 
 static bool
-estimate(int x)
+estimate(Lexer *lexer, int x)
 {
-    int c = nextchar();
-    if (x == c) return true; else pushback(c);
+    int c = nextchar(lexer);
+    if (x == c) return true; else pushback(lexer, c);
     return false;
 }
 
@@ -547,124 +1584,368 @@ is_simple_escape(int c)
     }
 }
 
+/* EOF is looked up as 0xff, which has no class */
 static bool
-is_nondigit(int c) { return isalpha(c) || c == '_'; }
+is_nondigit(int c) { return char_class[c & 0xff] & CC_NONDIGIT; }
 
 static bool
 is_digit(int c, int base)
 {
     switch (base)
     {
-    case 8:  return isdigit(c) && c != '8' && c != '9';
-    case 10: return isdigit(c);
-    case 16: return isdigit(c) ||
-            c == 'a' || c == 'b' || c == 'c' || c == 'd' || c == 'e' || c == 'f' ||
-            c == 'A' || c == 'B' || c == 'C' || c == 'D' || c == 'E' || c == 'F';
+    case 8:  return char_class[c & 0xff] & CC_OCT;
+    case 10: return char_class[c & 0xff] & CC_DIGIT;
+    case 16: return char_class[c & 0xff] & CC_HEX;
     }
     return false;
 }
 
 static bool
-is_space(int c) { return c == ' ' || c == '\t' || c == '\v'; }
+is_return(int c) { return char_class[c & 0xff] & CC_RETURN; }
 
-static bool
-is_return(int c) { return c == '\n' || c == '\r'; }
-
-static void
-set_keyword(Token *tk)
+static enum KeywordID
+find_keyword(const char *s, int len)
 {
-    int i;
-    for (i = 0; keywords[i] != 0; i++)
-    {
-        if (cmp2_string(tk->str, keywords[i]) == 0)
-        {
-            tk->kind = TK_KEYWORD;
-            return;
-        }
-    }
+    unsigned int h;
+    enum KeywordID kw;
+
+    if (len < KW_MIN_LEN || len > KW_MAX_LEN) return KW_INVALID;
+    h = len + kw_asso[(unsigned char)s[0]] + kw_asso[(unsigned char)s[len-1]];
+    if (h >= KW_HASH_SIZE) return KW_INVALID;
+    kw = kw_slot[h];
+    if (kw == KW_INVALID) return KW_INVALID;
+    if (strncmp(s, keywords[kw], len) == 0 && keywords[kw][len] == '\0') return kw;
+    return KW_INVALID;
 }
 
 static void
-skip()
+skip(Lexer *lexer)
 {
-    int c;
     for (;;)
     {
-        c = nextchar();
-        if (is_space(c) || is_return(c)) continue;
-        if (c == '/')
+        switch (*lexer->cur)
         {
-            if (estimate('*'))
+        case ' ': case '\t': case '\v': case '\r': case '\n':
+            lexer->cur = skip_blank(lexer->cur);
+            continue;
+        case '/':
+            if (lexer->cur[1] == '*')
             {
-                for (;;)
+                const char *start = lexer->cur;
+                for (lexer->cur += 2; ; lexer->cur++)
                 {
-                    if ((c = nextchar()) == '*')
+                    lexer->cur = find_comment_end(lexer->cur);
+                    if (*lexer->cur == '*') break;
+                    if (lexer->cur >= lexer->end)
                     {
-                        if (estimate('/')) break;
+                        lex_error(lexer, start, "Unterminated comment.");
+                        return;
                     }
                 }
+                lexer->cur += 2;
             }
-            else if (estimate('/'))
+            else if (lexer->cur[1] == '/')
             {
-                for (; !is_return(c); c = nextchar());
+                for (lexer->cur += 2; ; lexer->cur++)
+                {
+                    lexer->cur = find_eol(lexer->cur);
+                    if (*lexer->cur != '\0' || lexer->cur >= lexer->end) break;
+                }
             }
             else
             {
-                pushback(c);
                 return;
             }
-        }
-        else
-        {
-            pushback(c);
+            continue;
+        default:
             return;
         }
     }
 }
 
+/* Only the character returned by the last nextchar() can be pushed back. */
 static void
-pushback(int c) { char_stack[sp++] = c; }
+pushback(Lexer *lexer, int c)
+{
+    if (c != EOF) lexer->cur--;
+}
 
 static int
-nextchar()
+nextchar(Lexer *lexer)
 {
-    int c;
+    int c = (unsigned char)*lexer->cur;
+
+    if (c == '\0' && lexer->cur >= lexer->end) return EOF;
+    lexer->cur++;
+    return c;
+}
+
+/* reports an error at the position at */
+static void
+lex_error(Lexer *lexer, const char *at, const char *f, ...)
+{
+    char buf[256];
+    va_list list;
+    unsigned int row, col;
+
+    lexer->errors++;
+    if (lexer->quiet) return;
+    decode_loc(lexer->sm, lexer->base + (SrcLoc)(at - lexer->src), &row, &col);
+    va_start(list, f);
+    vsnprintf(buf, sizeof(buf), f, list);
+    va_end(list);
+    print_error(row, col, "%s", buf);
+}
+
+/* worker of lex_parallel() */
+static void *
+lex_chunk(void *arg)
+{
+    Chunk *c = (Chunk*)arg;
+    SrcLoc limit = c->lexer.base + (SrcLoc)(c->limit - c->lexer.src);
+    int errors;
+
+    for (;;)
+    {
+        errors = c->lexer.errors;
+        next_lexeme(&c->lexer, &c->pending);
+        c->pending_error = (c->lexer.errors != errors);
+        if (c->pending.loc >= limit) break;
+        if (c->pending_error) c->last_error = c->tokens->len;
+        add_token_array(c->tokens, &c->pending);
+    }
+    return NULL;
+}
+
+/*
+ * Returns the beginning of a line at or after p, which is probably
+ * not inside a comment: if the nearest comment delimiter before p
+ * opens a comment, the line after its end is taken.
+ * Literals never span lines, so they need no care.
+ */
+static const char *
+find_boundary(const char *p, const char *lo, const char *end)
+{
+    const char *q;
+
+    if (p - lo > PRESCAN_WINDOW) lo = p - PRESCAN_WINDOW;
+    for (q = p; q > lo + 1; q--)
+    {
+        if (q[-2] == '*' && q[-1] == '/') break;
+        if (q[-2] == '/' && q[-1] == '*')
+        {
+            for (; p < end; p++)
+            {
+                p = find_comment_end(p);
+                if (*p == '*') break;
+            }
+            break;
+        }
+    }
+    q = memchr(p, '\n', end - p);
+    return (q == NULL) ? end : q + 1;
+}
+
+/* Puts the lexer at lx */
+static void
+seek(Lexer *lexer, const Lexeme *lx)
+{
+    lexer->cur = lexer->src + (lx->loc - lexer->base);
+}
 
-    if (sp > 0) return char_stack[--sp];
-    
-    c = (file == NULL) ? EOF : fgetc(file);
-    if (c == EOF)
+/*
+ * Lexes again what follows the last lexeme of a, as next_lexeme()
+ * would do, reporting the errors.
+ * The lexer itself must not have moved since lex_parallel() began.
+ */
+static void
+relex(Lexer *lexer, TokenArray *a)
+{
+    Lexer sub = *lexer;
+    Lexeme lx;
+
+    sub.errors = 0;
+    sub.interning = false;
+    if (a->len > 0)
     {
-        close_file();
+        seek(&sub, &a->v[a->len-1]);
+        next_lexeme(&sub, &lx);
     }
-    else if (c == '\n')
+    do
+    {
+        next_lexeme(&sub, &lx);
+        add_token_array(a, &lx);
+    } while (lx.kind != TK_ENDFILE);
+    lexer->errors += sub.errors;
+}
+
+/* Identifiers and literals are interned, keywords and punctuators are not */
+static bool
+has_symbol(const Lexeme *lx)
+{
+    return lx->kind == TK_IDENT || lx->kind == TK_CONSTANT || lx->kind == TK_STRING;
+}
+
+static bool
+is_number(const Lexer *lexer, const Lexeme *lx)
+{
+    return lx->kind == TK_CONSTANT && *lexeme_text(lexer, lx) != '\'';
+}
+
+/* Resizes a, moving a loaded array out of its mapping */
+static void
+grow_token_array(TokenArray *a, int size)
+{
+    Lexeme *v;
+
+    if (a->map != NULL)
     {
-        line++;
-        column = 0;
+        v = (Lexeme*)try_malloc(sizeof(Lexeme) * size);
+        memcpy(v, a->v, sizeof(Lexeme) * a->len);
+        if (munmap(a->map, a->mapsize) != 0) perror("munmap");
+        a->map = NULL;
+        a->mapsize = 0;
+        a->v = v;
     }
     else
     {
-        column++;
+        a->v = (Lexeme*)try_realloc(a->v, sizeof(Lexeme) * size);
     }
-    return c;
+    a->size = size;
+}
+
+/*
+ * The index of the first lexeme of a which ends (by_end) or begins at
+ * or after the offset off in the source. The last lexeme, TK_ENDFILE,
+ * is at the end of the source, so one is always found.
+ */
+static int
+find_lexeme(const Lexer *lexer, const TokenArray *a, size_t off, bool by_end)
+{
+    int lo = 0, hi = a->len - 1, mid;
+    size_t at;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        at = a->v[mid].loc - lexer->base + (by_end ? a->v[mid].len : 0);
+        if (at < off) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+/* A fast hash of the content of a source, 8 bytes at a time */
+static unsigned long long
+hash_source(const char *p, size_t len)
+{
+    unsigned long long h = len ^ 0x9e3779b97f4a7c15ull, w;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8)
+    {
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    w = 0;
+    memcpy(&w, p + i, len - i);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ull;
+    return h ^ (h >> 29);
+}
+
+static bool
+write_all(int fd, const void *p, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        len -= n;
+        p = (const char*)p + n;
+    }
+    return true;
 }
 
 #ifdef TEST_LEX
 int
 main(int argc, char *argv[])
 {
-    Token *token;
+    SourceManager *sm = NULL;
+    Lexer *lexer;
+    TokenArray *a;
+    Token *tk;
+    Lexeme lx;
+    PoolStats st;
+    const char *cache = NULL;
+    int i;
 
-    if (argc != 2) exit(EXIT_FAILURE);
+    // lex [-c tokfile] file [threads], lex -k file for tokens, or lex - to read stdin
+    if (argc == 2 && strcmp(argv[1], "-") == 0)
+    {
+        sm = make_source_manager();
+        lexer = make3_lexer(sm, STDIN_FILENO, "-");
+        for (next_lexeme(lexer, &lx); lx.kind != TK_ENDFILE; next_lexeme(lexer, &lx))
+        {
+            print_lexeme(lexer, &lx);
+        }
+        free_lexer(&lexer);
+        free_source_manager(&sm);
+        return EXIT_SUCCESS;
+    }
+    if (argc == 3 && strcmp(argv[1], "-k") == 0)
+    {
+        lexer = make_lexer(argv[2]);
+        if (lexer == NULL) exit(EXIT_FAILURE);
+        for (tk = next_token(lexer); tk->kind != TK_ENDFILE; tk = next_token(lexer))
+        {
+            print_token(tk);
+            free_token(&tk);
+        }
+        token_pool_stats(lexer, &st);
+        fprintf(stderr, "%lu tokens, %lu slabs, %lu freed, %lu spellings, %lu allocated\n",
+                st.tokens, st.token_allocs, st.freed, st.strings, st.string_allocs);
+        free_lexer(&lexer);
+        return EXIT_SUCCESS;
+    }
+    if (argc > 3 && strcmp(argv[1], "-c") == 0)
+    {
+        cache = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc != 2 && argc != 3) exit(EXIT_FAILURE);
 
-    open_file(argv[1]);
-    for (;;) 
+    lexer = make_lexer(argv[1]);
+    if (lexer == NULL) exit(EXIT_FAILURE);
+    if (cache != NULL)
+    {
+        a = lex_cached(lexer, cache);
+        for (i = 0; a->v[i].kind != TK_ENDFILE; i++) print_lexeme(lexer, &a->v[i]);
+    }
+    else if (argc == 3)
+    {
+        a = lex_parallel(lexer, atoi(argv[2]));
+        for (i = 0; a->v[i].kind != TK_ENDFILE; i++) print_lexeme(lexer, &a->v[i]);
+    }
+    else
     {
-        token = next_token();
-        if (token->kind == TK_ENDFILE) break;
-        print_token(token);
-        free_token(&token);
+        // in batches, the way a streaming consumer would
+        a = make_token_array();
+        do
+        {
+            a->len = 0;
+            fill_token_array(lexer, a, TOKEN_BATCH);
+            for (i = 0; i < a->len && a->v[i].kind != TK_ENDFILE; i++)
+            {
+                print_lexeme(lexer, &a->v[i]);
+            }
+        } while (a->v[a->len-1].kind != TK_ENDFILE);
     }
+    free_token_array(&a);
+    free_lexer(&lexer);
     return EXIT_SUCCESS;
 }
 #endif
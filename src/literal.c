@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "tilde.h"
+
+#define INIT_LITERALS (256)
+#define LIT_CHUNK     (64*1024)  // bytes of literals allocated at a time
+#define BUFSIZE       (256)
+
+/*
+ * String literals are decoded to the bytes they stand for and pooled,
+ * so that literals which decode to the same bytes are one literal
+ * however they are spelled or often they are written. The bytes of a
+ * literal are followed by a '\0' and never move.
+ *
+ * For a backend, literal_section() lays all the literals out in one
+ * block of read-only data, where a literal which ends another one, as
+ * "bar" ends "foobar", is not stored again but points into it.
+ * Literals are counted from 1 and are never freed; LIT_NONE is none.
+ * The pool may be used from any thread.
+ */
+typedef struct
+{
+    const char *bytes;
+    size_t len;       /* without the '\0' */
+    size_t offset;    /* in the section */
+} Entry;
+
+typedef struct Chunk
+{
+    struct Chunk *next;
+    size_t used;
+    size_t size;
+    char bytes[];
+} Chunk;
+
+static Hashmap *table;  /* bytes -> literal */
+static Entry *entries;
+static Literal nliterals;
+static Literal size;
+static Chunk *chunks;
+static char *section;   /* laid out for the first nlaid literals */
+static size_t section_size;
+static Literal nlaid;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Literal add_literal(const char *s, size_t len);
+static const char *store(const char *s, size_t len);
+static int  cmp_reversed(const void *a, const void *b);
+static void lay_out();
+
+/*
+ * Decodes the spelling of len bytes at s of a string literal, which
+ * next_lexeme() has found, and returns its literal. The escapes have
+ * been checked by the lexer; an invalid one stands for its character.
+ */
+Literal
+decode_literal(const char *s, size_t len)
+{
+    char buf[BUFSIZE] = "", *p = buf, *d;
+    const char *end = s + len;
+    Literal lit;
+
+    if (len > 0 && *s == '"') s++;
+    if ((size_t)(end - s) > BUFSIZE) p = (char*)try_malloc(end - s);
+    // up to the closing quote, if the literal has one
+    for (d = p; s < end && *s != '"'; s++)
+    {
+        if (*s != '\\' || s + 1 == end)
+        {
+            *d++ = *s;
+            continue;
+        }
+        switch (*++s)
+        {
+        case 'a': *d++ = '\a'; break;
+        case 'b': *d++ = '\b'; break;
+        case 'f': *d++ = '\f'; break;
+        case 'n': *d++ = '\n'; break;
+        case 'r': *d++ = '\r'; break;
+        case 't': *d++ = '\t'; break;
+        case 'v': *d++ = '\v'; break;
+        default:  *d++ = *s;   break;
+        }
+    }
+    lit = intern_literal(p, (size_t)(d - p));
+    if (p != buf) free(p);
+    return lit;
+}
+
+/* Returns the literal of the len bytes at s */
+Literal
+intern_literal(const char *s, size_t len)
+{
+    Literal lit;
+
+    pthread_mutex_lock(&lock);
+    lit = add_literal(s, len);
+    pthread_mutex_unlock(&lock);
+    return lit;
+}
+
+/* Returns the bytes of lit, which are followed by a '\0', or NULL for LIT_NONE */
+const char *
+literal_bytes(Literal lit, size_t *len)
+{
+    const char *s = NULL;
+
+    pthread_mutex_lock(&lock);
+    if (lit != LIT_NONE && lit < nliterals)
+    {
+        s = entries[lit].bytes;
+        *len = entries[lit].len;
+    }
+    pthread_mutex_unlock(&lock);
+    return s;
+}
+
+/*
+ * Returns the section of all the literals, and its size in size.
+ * Each literal is there with its '\0', at literal_offset().
+ * The section is laid out again if literals have been added since.
+ */
+const char *
+literal_section(size_t *size)
+{
+    const char *s;
+
+    pthread_mutex_lock(&lock);
+    if (nlaid != nliterals) lay_out();
+    s = section;
+    *size = section_size;
+    pthread_mutex_unlock(&lock);
+    return s;
+}
+
+/* The offset of lit in the section, which literal_section() has laid out */
+size_t
+literal_offset(Literal lit)
+{
+    size_t off = 0;
+
+    pthread_mutex_lock(&lock);
+    if (lit != LIT_NONE && lit < nlaid) off = entries[lit].offset;
+    pthread_mutex_unlock(&lock);
+    return off;
+}
+
+static void
+liberator_none(void *data) { }
+
+/* Frees all the literals, whose numbers may be given again afterwards */
+void
+free_literals()
+{
+    Chunk *c;
+
+    pthread_mutex_lock(&lock);
+    if (table != NULL)
+    {
+        free_hashmap(&table, liberator_none);
+        free(entries);
+        entries = NULL;
+        nliterals = size = 0;
+    }
+    while ((c = chunks) != NULL)
+    {
+        chunks = c->next;
+        free(c);
+    }
+    free(section);
+    section = NULL;
+    section_size = 0;
+    nlaid = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+static Literal
+add_literal(const char *s, size_t len)
+{
+    StrView v = view3_string(s, len);
+    Literal lit;
+
+    if (table == NULL)
+    {
+        table = make_hashmap(INIT_LITERALS);
+        size = INIT_LITERALS;
+        entries = (Entry*)try_malloc(sizeof(Entry) * size);
+        nliterals = 1;
+    }
+    v.hash = hash_view(v);
+    lit = (Literal)(uintptr_t)search_hashmap(table, v);
+    if (lit != LIT_NONE) return lit;
+
+    if (nliterals == size)
+    {
+        size *= 2;
+        entries = (Entry*)try_realloc(entries, sizeof(Entry) * size);
+    }
+    lit = nliterals++;
+    entries[lit].bytes = store(s, len);
+    entries[lit].len = len;
+    entries[lit].offset = 0;
+    add2_hashmap(table, new4_string(v), (void*)(uintptr_t)lit);
+    return lit;
+}
+
+/* Copies the len bytes at s and a '\0' where they stay */
+static const char *
+store(const char *s, size_t len)
+{
+    Chunk *c = chunks;
+    size_t n;
+    char *p;
+
+    if (c == NULL || c->size - c->used < len + 1)
+    {
+        n = (len + 1 > LIT_CHUNK) ? len + 1 : LIT_CHUNK;
+        c = (Chunk*)try_malloc(sizeof(Chunk) + n);
+        c->used = 0;
+        c->size = n;
+        // a chunk of one long literal does not take the place of the current one
+        if (chunks != NULL && n > LIT_CHUNK)
+        {
+            c->next = chunks->next;
+            chunks->next = c;
+        }
+        else
+        {
+            c->next = chunks;
+            chunks = c;
+        }
+    }
+    p = c->bytes + c->used;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    c->used += len + 1;
+    return p;
+}
+
+/* Orders literals by their bytes read backwards */
+static int
+cmp_reversed(const void *a, const void *b)
+{
+    const Entry *x = &entries[*(const Literal*)a], *y = &entries[*(const Literal*)b];
+    const unsigned char *p = (const unsigned char*)x->bytes + x->len;
+    const unsigned char *q = (const unsigned char*)y->bytes + y->len;
+    size_t n = (x->len < y->len) ? x->len : y->len;
+
+    for (; n > 0; n--)
+    {
+        if (*--p != *--q) return (*p < *q) ? -1 : 1;
+    }
+    return (x->len < y->len) ? -1 : (x->len > y->len);
+}
+
+/*
+ * Sorted by their reversed bytes, a literal which ends others comes
+ * right before one of them, as all that come between end with it too;
+ * so going backwards each literal either ends the one after it, which
+ * has its place already, or begins a new piece of the section.
+ */
+static void
+lay_out()
+{
+    Literal *order, lit, next;
+    size_t off = 0;
+    int i, n = (int)nliterals - 1;
+
+    order = (Literal*)try_malloc(sizeof(Literal) * (n > 0 ? n : 1));
+    for (i = 0; i < n; i++) order[i] = (Literal)(i + 1);
+    qsort(order, n, sizeof(Literal), cmp_reversed);
+
+    for (i = n - 1; i >= 0; i--)
+    {
+        lit = order[i];
+        next = (i + 1 < n) ? order[i+1] : LIT_NONE;
+        if (next != LIT_NONE && entries[lit].len <= entries[next].len &&
+            memcmp(entries[lit].bytes, entries[next].bytes + entries[next].len - entries[lit].len,
+                   entries[lit].len) == 0)
+        {
+            entries[lit].offset = entries[next].offset + entries[next].len - entries[lit].len;
+        }
+        else
+        {
+            entries[lit].offset = off;
+            off += entries[lit].len + 1;
+        }
+    }
+
+    free(section);
+    section = (char*)try_malloc(off > 0 ? off : 1);
+    for (i = 0; i < n; i++)
+    {
+        lit = order[i];
+        memcpy(section + entries[lit].offset, entries[lit].bytes, entries[lit].len + 1);
+    }
+    section_size = off;
+    nlaid = nliterals;
+    free(order);
+}
+
+#ifdef TEST_LITERAL
+int
+main(int argc, char *argv[])
+{
+    static const char *spellings[] =
+    {
+        "\"foobar\"", "\"bar\"", "\"ar\"", "\"\"", "\"foo\"", "\"a\\tb\"", "\"a\\?\"", "\"a?\"",
+        "\"x\\\"y\\\\\"", "\"unterminated", "\"nobar\"", "\"a\\tb\"",
+    };
+    static const char *decoded[] =
+    {
+        "foobar", "bar", "ar", "", "foo", "a\tb", "a?", "a?",
+        "x\"y\\", "unterminated", "nobar", "a\tb",
+    };
+    enum { N = sizeof(spellings) / sizeof(spellings[0]) };
+    Literal lits[N];
+    const char *s, *sec;
+    size_t len = 0, secsize, expected = 0;
+    int i, j, failed = 0;
+
+    for (i = 0; i < N; ++i)
+    {
+        lits[i] = decode_literal(spellings[i], strlen(spellings[i]));
+        s = literal_bytes(lits[i], &len);
+        if (s == NULL || len != strlen(decoded[i]) || memcmp(s, decoded[i], len + 1) != 0)
+        {
+            printf("%s\n", spellings[i]);
+            failed++;
+        }
+    }
+    // the same bytes are one literal, however spelled
+    if (lits[6] != lits[7] || lits[5] != lits[11] || lits[0] == lits[1]) failed++;
+
+    // every literal is in the section, and only those which end no other take room
+    sec = literal_section(&secsize);
+    for (i = 0; i < N; ++i)
+    {
+        s = literal_bytes(lits[i], &len);
+        if (literal_offset(lits[i]) + len + 1 > secsize ||
+            memcmp(sec + literal_offset(lits[i]), s, len + 1) != 0)
+        {
+            printf("offset %d\n", i);
+            failed++;
+        }
+    }
+    for (i = 0; i < N; ++i)
+    {
+        bool ends = false, first = true;
+        s = literal_bytes(lits[i], &len);
+        for (j = 0; j < N; ++j)
+        {
+            size_t n = 0;
+            const char *t = literal_bytes(lits[j], &n);
+            if (lits[j] == lits[i] && j < i) first = false;
+            if (lits[j] != lits[i] && n > len && memcmp(t + n - len, s, len) == 0) ends = true;
+        }
+        if (first && !ends) expected += len + 1;
+    }
+    if (secsize != expected)
+    {
+        printf("size %zu, not %zu\n", secsize, expected);
+        failed++;
+    }
+
+    // a literal added later gets laid out again
+    lits[0] = intern_literal("zzz", 3);
+    sec = literal_section(&secsize);
+    if (secsize != expected + 4 || memcmp(sec + literal_offset(lits[0]), "zzz", 4) != 0) failed++;
+    free_literals();
+
+    // if correct, print 0
+    printf("%d\n", failed);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
@@ -18,11 +18,13 @@ Type  *float_t = &(Type){.size = 4, .align = 4, .is_const = false, .is_volatile
 Type *double_t = &(Type){.size = 8, .align = 8, .is_const = false, .is_volatile = false, .tt = TT_BASIC};
 Type    *ptr_t = &(Type){.size = 8, .align = 8, .is_const = false, .is_volatile = false, .tt = TT_POINTER};
 
-static List *stack; // List<Token*>
+static Lexer *lexer;
+static TokenArray *tokens;
+static int tkpos; // index of the next token
 
 /* prototypes */
 // declaration
-static void make_extdecl(List *list);
+static void make_extdecl(Vec *list);
 static Node *make_initializer();
 static void make_decl_spec(Node *node);
 static bool make_storage_class_spec(Node *node);
@@ -34,8 +36,8 @@ static Type *make_pointer();
 static void make_direct_declarator(Node *node);
 static Type *make_direct_decl_array();
 static bool make_type_qual_list(bool *isc, bool *isv);
-static List *make_parameter_type_list(bool *is_vargs);
-static List *make_parameter_list();
+static void make_parameter_type_list(SmallVec *list, bool *is_vargs);
+static void make_parameter_list(SmallVec *list);
 static Node *make_parameter_decl();
 static Type *ret_type_tail(Type *t);
 
@@ -57,85 +59,70 @@ static Node *make_jump_stmt(bool in_switch);
 static Node *malloc_node(enum AST ast);
 static Type *malloc_type(enum TypeType tt);
 static Type *copy_type(const Type *t);
-static void  pushback(Token *tk);
-static Token *next();
-static bool  is_puncid(const Token *tk, enum PnctID id);
-static bool  is_keyword(const Token *tk, const char *s);
+static const Lexeme *peek(int k);
+static const Lexeme *consume();
+static bool  is_puncid(const Lexeme *tk, enum PnctID id);
+static bool  is_keyword(const Lexeme *tk, enum KeywordID kw);
 
 void
 init_parser(const char *file)
 {
-    open_file(file);
-    stack = make_list();
+    lexer = make_lexer(file);
+    if (lexer == NULL) exit(EXIT_FAILURE);
+    tokens = lex_all(lexer);
+    tkpos = 0;
 }
 
-// List<Node*>
-List *
+// Vec<Node*>
+Vec *
 parse_top()
 {
-    List *list;
-    Node *node;
-    Token *tk;
+    Vec *list;
 
-    list = make_list();
+    list = make_vec();
     for (;;)
     {
         make_extdecl(list);
-        tk = next();
-        if (tk->kind == TK_ENDFILE) return list;
+        if (peek(0)->kind == TK_ENDFILE) return list;
     }
 }
 
-/* List<Node*> */
+/* Vec<Node*> */
 static void
-make_extdecl(List *list)
+make_extdecl(Vec *list)
 {
     Node *node;
-    Token *tk;
+    const Lexeme *tk;
 
     node = malloc_node(AST_VAR_DECL);
     // function-definition/declaration
     make_decl_spec(node);
     make_declarator(node);
 
-    tk = next();
-    if (is_puncid(tk, P_CRL_BRCK_L))
+    if (is_puncid(peek(0), P_CRL_BRCK_L))
     {
         // function definition
-        free_token(&tk);
+        consume();
         node->kind = AST_FUNC_DEF;
         node->init_or_body = make_compound_stmt(false);
-        tk = next();
-        if (is_puncid(tk, P_CRL_BRCK_R))
-        {
-            free_token(&tk);
-        }
-        else
+        tk = consume();
+        if (!is_puncid(tk, P_CRL_BRCK_R))
         {
             // error
         }
-        add_list(list, node);
+        add_vec(list, node);
         return;
     }
-    else
-    {
-        pushback(tk);
-    }
     
     for (;;)
     {
-        tk = next();
-        if (is_puncid(tk, P_ASGN))
+        if (is_puncid(peek(0), P_ASGN))
         {
-            free_token(&tk);
+            consume();
             node->init_or_body = make_initializer();
         }
-        else
-        {
-            pushback(tk);
-        }
         
-        tk = next();
+        tk = consume();
         if (is_puncid(tk, P_COMMA))
         {
             Node *next_node;
@@ -143,14 +130,12 @@ make_extdecl(List *list)
             next_node->sc = node->sc;
             next_node->type = ret_type_tail(node->type);
             make_declarator(next_node);
-            add_list(list, node);
+            add_vec(list, node);
             node = next_node;
-            free_token(&tk);
         }
         else if (is_puncid(tk, P_SCOLON))
         {
-            free_token(&tk);
-            add_list(list, node);
+            add_vec(list, node);
             return;
         }
         else
@@ -163,17 +148,13 @@ make_extdecl(List *list)
 static Node *
 make_initializer()
 {
-    Token *tk;
-
-    tk = next();
-    if (is_puncid(tk, P_CRL_BRCK_L))
+    if (is_puncid(peek(0), P_CRL_BRCK_L))
     {
-        free_token(&tk);
+        consume();
         // TODO
     }
     else
     {
-        pushback(tk);
         return make_assignment_exp();
     }
 }
@@ -231,188 +212,91 @@ make_decl_spec(Node *node)
 static bool
 make_storage_class_spec(Node *node)
 {
-    Token *tk;
-    bool ret;
+    const Lexeme *tk = peek(0);
 
-    tk = next();
-    if (tk->kind != TK_KEYWORD)
-    {
-        pushback(tk);
-        return false;
-    }
+    if (tk->kind != TK_KEYWORD) return false;
 
-    ret = false;
-    if (cmp2_string(tk->str, "typedef") == 0)
+    switch (tk->kw)
     {
-        node->sc = SC_TYPEDEF;
-        ret = true;
-    }
-    else if (cmp2_string(tk->str, "extern") == 0)
-    {
-        node->sc = SC_EXTERN;
-        ret = true;
-    }
-    else if (cmp2_string(tk->str, "static") == 0)
-    {
-        node->sc = SC_STATIC;
-        ret = true;
+    case KW_TYPEDEF: node->sc = SC_TYPEDEF; break;
+    case KW_EXTERN:  node->sc = SC_EXTERN;  break;
+    case KW_STATIC:  node->sc = SC_STATIC;  break;
+    default:         return false;
     }
 
-    if (ret) free_token(&tk); pushback(tk);
-    return ret;
+    consume();
+    return true;
 }
 
 static Type *
 make_type_spec()
 {
-    Token *tk;
-
-    tk = next();
-    if (tk->kind != TK_KEYWORD)
-    {
-        pushback(tk);
-        return false;
-    }
-
-
-    if (cmp2_string(tk->str, "void") == 0)
-    {
-        free_token(&tk);
-        return copy_type(void_t);
-    }
-    else if (cmp2_string(tk->str, "char") == 0)
-    {
-        free_token(&tk);
-        return copy_type(char_t);
-    }
-    else if (cmp2_string(tk->str, "uchar") == 0)
-    {
-        free_token(&tk);
-        return copy_type(uchar_t);
-    }
-    else if (cmp2_string(tk->str, "short") == 0)
-    {
-        free_token(&tk);
-        return copy_type(short_t);
-    }
-    else if (cmp2_string(tk->str, "ushort") == 0)
-    {
-        free_token(&tk);
-        return copy_type(ushort_t);
-    }
-    else if (cmp2_string(tk->str, "int") == 0)
-    {
-        free_token(&tk);
-        return copy_type(int_t);
-    }
-    else if (cmp2_string(tk->str, "uint") == 0)
-    {
-        free_token(&tk);
-        return copy_type(uint_t);
-    }
-    else if (cmp2_string(tk->str, "long") == 0)
-    {
-        free_token(&tk);
-        return copy_type(long_t);
-    }
-    else if (cmp2_string(tk->str, "ulong") == 0)
-    {
-        free_token(&tk);
-        return copy_type(ulong_t);
-    }
-    else if (cmp2_string(tk->str, "float") == 0)
-    {
-        free_token(&tk);
-        return copy_type(float_t);
-    }
-    else if (cmp2_string(tk->str, "double") == 0)
-    {
-        free_token(&tk);
-        return copy_type(double_t);
-    }
-    else if (cmp2_string(tk->str, "bool") == 0)
-    {
-        free_token(&tk);
-        return copy_type(bool_t);
-    }
-    else if (cmp2_string(tk->str, "struct") == 0)
-    {
-        Type *struct_type;
-        free_token(&tk);
-        struct_type = malloc_type(TT_STRUCT_UNION);
-        struct_type->is_struct = true;
-        return struct_type;
-    }
-    else if (cmp2_string(tk->str, "union") == 0)
-    {
-        Type *union_type;
-        free_token(&tk);
-        union_type = malloc_type(TT_STRUCT_UNION);
-        union_type->is_struct = false;
-        return union_type;
-    }
-    else if (cmp2_string(tk->str, "enum") == 0)
-    {
-        free_token(&tk);
-        return NULL;
-    }
-    else if (cmp2_string(tk->str, "typedef") == 0)
-    {
-        free_token(&tk);
+    const Lexeme *tk;
+    Type *type;
+
+    tk = peek(0);
+    if (tk->kind != TK_KEYWORD) return NULL;
+
+    switch (tk->kw)
+    {
+    case KW_VOID:   type = copy_type(void_t);   break;
+    case KW_CHAR:   type = copy_type(char_t);   break;
+    case KW_UCHAR:  type = copy_type(uchar_t);  break;
+    case KW_SHORT:  type = copy_type(short_t);  break;
+    case KW_USHORT: type = copy_type(ushort_t); break;
+    case KW_INT:    type = copy_type(int_t);    break;
+    case KW_UINT:   type = copy_type(uint_t);   break;
+    case KW_LONG:   type = copy_type(long_t);   break;
+    case KW_ULONG:  type = copy_type(ulong_t);  break;
+    case KW_FLOAT:  type = copy_type(float_t);  break;
+    case KW_DOUBLE: type = copy_type(double_t); break;
+    case KW_BOOL:   type = copy_type(bool_t);   break;
+    case KW_STRUCT:
+        type = malloc_type(TT_STRUCT_UNION);
+        type->is_struct = true;
+        break;
+    case KW_UNION:
+        type = malloc_type(TT_STRUCT_UNION);
+        type->is_struct = false;
+        break;
+    case KW_ENUM:
+    case KW_TYPEDEF:
+        type = NULL;
+        break;
+    default:
         return NULL;
     }
 
-    pushback(tk);
-    return NULL;
+    consume();
+    return type;
 }
 
 static bool
 make_type_qual(bool *isconst, bool *isvolatile)
 {
-    Token *tk;
+    const Lexeme *tk = peek(0);
 
-    tk = next();
-    if (tk->kind != TK_KEYWORD)
-    {
-        pushback(tk);
-        return false;
-    }
-
-    if (cmp2_string(tk->str, "const") == 0)
+    if (is_keyword(tk, KW_CONST))
     {
+        consume();
         *isconst = true;
-        free_token(&tk);
         return true;
     }
-    else if (cmp2_string(tk->str, "volatile") == 0)
+    else if (is_keyword(tk, KW_VOLATILE))
     {
+        consume();
         *isvolatile = true;
-        free_token(&tk);
         return true;
     }
-    pushback(tk);
     return false;
 }
 
 static bool
 make_func_spec()
 {
-    Token *tk;
-
-    tk = next();
-    if (tk->kind != TK_KEYWORD)
-    {
-        pushback(tk);
-        return false;
-    }
-
-    if (cmp2_string(tk->str, "inline") == 0)
-    {
-        free_token(&tk);
-        return true;
-    }
-    pushback(tk);
-    return false;
+    if (!is_keyword(peek(0), KW_INLINE)) return false;
+    consume();
+    return true;
 }
 
 static void
@@ -466,7 +350,6 @@ make_declarator(Node *node)
 static Type *
 make_pointer()
 {
-    Token *tk;
     Type *type = NULL;
     Type *type_temp = NULL;
     bool is_const;
@@ -477,13 +360,8 @@ make_pointer()
         is_const = false;
         is_volatile = false;
         
-        tk = next();
-        if (!is_puncid(tk, P_MULT))
-        {
-            pushback(tk);
-            return type;
-        }
-        free_token(&tk);
+        if (!is_puncid(peek(0), P_MULT)) return type;
+        consume();
         
         type = copy_type(ptr_t);
         // type-qualifier-list
@@ -500,24 +378,20 @@ make_pointer()
 static void
 make_direct_declarator(Node *node)
 {
-    Token *tk;
+    const Lexeme *tk;
 
-    tk = next();
+    tk = peek(0);
     if (tk->kind == TK_IDENT)
     {
-        node->name = new_string(tk->str);
-        free_token(&tk);
+        consume();
+        node->name = tk->sym;
     }
     else if (is_puncid(tk, P_PAREN_L))
     {
+        consume();
         make_declarator(node);
-        free_token(&tk);
-        tk = next();
-        if (is_puncid(tk, P_PAREN_R))
-        {
-            free_token(&tk);
-        }
-        else
+        tk = consume();
+        if (!is_puncid(tk, P_PAREN_R))
         {
             // error
         }
@@ -525,17 +399,17 @@ make_direct_declarator(Node *node)
     else
     {
         // error
-        pushback(tk);
         return;
     }
 
-    tk = next();
+    tk = peek(0);
     if (is_puncid(tk, P_PAREN_L))
     {
+        consume();
         Type *t, *temp_tail;
         bool is_vargs = false;
         t = malloc_type(TT_FUNCTION);
-        t->args = make_parameter_type_list(&is_vargs);
+        make_parameter_type_list(&t->args, &is_vargs);
         
         temp_tail = ret_type_tail(node->type);
         if (temp_tail == NULL) node->type = t;
@@ -543,11 +417,9 @@ make_direct_declarator(Node *node)
         else if (temp_tail->tt == TT_POINTER)  temp_tail->ptr = t;
         else if (temp_tail->tt == TT_ARRAY)    temp_tail->base = t;
 
-        free_token(&tk);
-        tk = next();
+        tk = consume();
         if (is_puncid(tk, P_PAREN_R))
         {
-            free_token(&tk);
             return;
         }
         else
@@ -560,15 +432,8 @@ make_direct_declarator(Node *node)
         Type *t, *temp_tail;
         for (;;)
         {
-            if (is_puncid(tk, P_SQR_BRCK_L))
-            {
-                free_token(&tk);
-            }
-            else
-            {
-                pushback(tk);
-                return;
-            }
+            if (!is_puncid(peek(0), P_SQR_BRCK_L)) return;
+            consume();
             t = make_direct_decl_array();
 
             temp_tail = ret_type_tail(node->type);
@@ -577,36 +442,26 @@ make_direct_declarator(Node *node)
             else if (temp_tail->tt == TT_POINTER)  temp_tail->ptr = t;
             else if (temp_tail->tt == TT_ARRAY)    temp_tail->base = t;
 
-            tk = next();
-            if (is_puncid(tk, P_SQR_BRCK_R))
-            {
-                free_token(&tk);
-            }
-            else
+            tk = consume();
+            if (!is_puncid(tk, P_SQR_BRCK_R))
             {
                 // error
             }
-            tk = next();
         }
     }
-    else
-    {
-        pushback(tk);
-        return;
-    }
 }
 
 static Type *
 make_direct_decl_array()
 {
-    Token *tk;
+    const Lexeme *tk;
     Type *t;
     bool isconst = false, isvolatile = false;
     t = malloc_type(TT_ARRAY);
-    tk = next();
-    if (is_keyword(tk, "static"))
+    tk = peek(0);
+    if (is_keyword(tk, KW_STATIC))
     {
-        free_token(&tk);
+        consume();
         make_type_qual_list(&isconst, &isvolatile);
         t->is_const = isconst;
         t->is_volatile = isvolatile;
@@ -620,12 +475,11 @@ make_direct_decl_array()
     }
     else
     {
-        pushback(tk);
         if (make_type_qual_list(&isconst, &isvolatile))
         {
             t->is_const = isconst;
             t->is_volatile = isvolatile;
-            if (is_keyword(tk, "static"))
+            if (is_keyword(tk, KW_STATIC))
             {
                 t->is_static = true;
                 t->asn_exp = make_assignment_exp();
@@ -636,16 +490,14 @@ make_direct_decl_array()
                 return t;
             }
         }
-        tk = next();
-        if (is_puncid(tk, P_MULT))
+        if (is_puncid(peek(0), P_MULT))
         {
-            free_token(&tk);
+            consume();
             t->is_varray = true;
             return t;
         }
         else
         {
-            pushback(tk);
             t->asn_exp = make_assignment_exp();
             return t;
         }
@@ -664,74 +516,33 @@ make_type_qual_list(bool *is_const, bool *is_volatile)
     return true;
 }
 
-static List *
-make_parameter_type_list(bool *is_vargs)
+static void
+make_parameter_type_list(SmallVec *list, bool *is_vargs)
 {
-    List *list;
-    Token *tk, *tk2;
-
-    list = make_parameter_list();
+    make_parameter_list(list);
     
-    tk = next();
-    if (is_puncid(tk, P_COMMA))
-    {
-        tk2 = next();
-        if (is_puncid(tk2, P_TLEAD))
-        {
-            free_token(&tk);
-            free_token(&tk2);
-            *is_vargs = true;
-        }
-        else
-        {
-            pushback(tk2);
-            pushback(tk);
-        }
-    }
-    else
+    if (is_puncid(peek(0), P_COMMA) && is_puncid(peek(1), P_TLEAD))
     {
-        pushback(tk);
+        consume();
+        consume();
+        *is_vargs = true;
     }
-    return list;
 }
 
-static List *
-make_parameter_list()
+static void
+make_parameter_list(SmallVec *list)
 {
-    Token *tk;
-    List *list;
     Node *node;
 
-    list = make_list();
-    
-    tk = next();
-    if (is_puncid(tk, P_PAREN_R))
-    {
-        pushback(tk);
-        return list;
-    }
-    else
-    {
-        pushback(tk);
-    }
+    if (is_puncid(peek(0), P_PAREN_R)) return;
     for (;;)
     {
         node = make_parameter_decl();
         if (node == NULL) break;
-        add_list(list, node);
-        tk = next();
-        if (is_puncid(tk, P_COMMA))
-        {
-            free_token(&tk);
-        }
-        else
-        {
-            pushback(tk);
-            break;
-        }
+        add_smallvec(list, node);
+        if (!is_puncid(peek(0), P_COMMA)) break;
+        consume();
     }
-
-    return list;
 }
 
 static Node *
@@ -780,32 +591,33 @@ ret_type_tail(Type *t)
 static Node *
 make_primary_exp()
 {
-    Token *tk;
+    const Lexeme *tk;
     Node *node;
-    tk = next();
+    tk = consume();
     if (tk->kind == TK_IDENT)
     {
-        free_token(&tk);
         node = malloc_node(AST_IDENT);
+        node->sym = tk->sym;
+        return node;
     }
     else if (tk->kind == TK_CONSTANT)
     {
-        free_token(&tk);
         node = malloc_node(AST_CONSTANT);
+        node->sym = tk->sym;
+        return node;
     }
     else if (tk->kind == TK_STRING)
     {
-        free_token(&tk);
         node = malloc_node(AST_STRING);
+        node->sym = tk->sym;
+        return node;
     }
     else if (is_puncid(tk, P_PAREN_L))
     {
-        free_token(&tk);
         Node *ret = make_exp();
-        tk = next();
+        tk = consume();
         if (is_puncid(tk, P_PAREN_R))
         {
-            free_token(&tk);
             return ret;
         }
     }
@@ -864,73 +676,52 @@ make_statement(bool in_switch)
 static Node *
 make_labeled_stmt(bool in_switch)
 {
-    Token *tk;
+    const Lexeme *tk;
     Node *node = NULL;
 
-    tk = next();
+    tk = peek(0);
     if (in_switch)
     {
         // "case" and "default" are
         // appeared in only switch-statement
-        if (is_keyword(tk, "case"))
+        if (is_keyword(tk, KW_CASE))
         {
-            free_token(&tk);
+            consume();
             node = malloc_node(AST_CASE);
             node->case_exp = make_const_exp();
 
-            tk = next();
-            if (is_puncid(tk, P_COLON))
+            if (is_puncid(peek(0), P_COLON))
             {
-                free_token(&tk);
+                consume();
                 node->case_stmt = make_statement(true);
                 return node;
             }
-            else
-            {
-                pushback(tk);
-                // error
-            }
+            // error
+            return NULL;
         }
-        else if (is_keyword(tk, "default"))
+        else if (is_keyword(tk, KW_DEFAULT))
         {
-            free_token(&tk);
+            consume();
             node = malloc_node(AST_DEFAULT);
 
-            tk = next();
-            if (is_puncid(tk, P_COLON))
+            if (is_puncid(peek(0), P_COLON))
             {
-                free_token(&tk);
+                consume();
                 node->default_stmt = make_statement(true);
                 return node;
             }
-            else
-            {
-                pushback(tk);
-                // error
-            }
-        }
-    }
-    if (tk->kind == TK_IDENT)
-    {
-        Token *tk2 = next();
-        if (is_puncid(tk2, P_COLON))
-        {
-            node = malloc_node(AST_LABEL);
-            node->label = new_string(tk->str);
-            node->label_stmt = make_statement(in_switch);
-            free_token(&tk);
-            free_token(&tk2);
-            return node;
-        }
-        else
-        {
-            pushback(tk);
-            pushback(tk2);
+            // error
+            return NULL;
         }
     }
-    else
+    if (tk->kind == TK_IDENT && is_puncid(peek(1), P_COLON))
     {
-        pushback(tk);
+        consume();
+        consume();
+        node = malloc_node(AST_LABEL);
+        node->label = tk->sym;
+        node->label_stmt = make_statement(in_switch);
+        return node;
     }
     return NULL;
 }
@@ -938,29 +729,19 @@ make_labeled_stmt(bool in_switch)
 static Node *
 make_compound_stmt(bool in_switch)
 {
-    Token *tk;
-
-    tk = next();
-    if (is_puncid(tk, P_CRL_BRCK_L))
+    if (is_puncid(peek(0), P_CRL_BRCK_L))
     {
         Node *node = NULL;
-        List *list = make_list();
+        consume();
         node = malloc_node(AST_COMP_STMT);
-        node->stmts = list;
 
-        free_token(&tk);
         for (;;)
         {
-            tk = next();
-            if (is_puncid(tk, P_CRL_BRCK_R))
+            if (is_puncid(peek(0), P_CRL_BRCK_R))
             {
-                free_token(&tk);
+                consume();
                 return node;
             }
-            else
-            {
-                pushback(tk);
-            }
             // TODO
         }
     }
@@ -970,306 +751,239 @@ make_compound_stmt(bool in_switch)
 static Node *
 make_select_stmt(bool in_switch)
 {
-    Token *tk;
+    const Lexeme *tk;
     Node *node = NULL;
 
-    tk = next();
-    if (is_keyword(tk, "if"))
+    tk = peek(0);
+    if (is_keyword(tk, KW_IF))
     {
-        free_token(&tk);
-
-        tk = next();
-        if (is_puncid(tk, P_PAREN_L))
+        consume();
+        if (is_puncid(peek(0), P_PAREN_L))
         {
-            free_token(&tk);
+            consume();
             node = malloc_node(AST_IF);
             node->if_exp = make_exp();
 
-            tk = next();
-            if (is_puncid(tk, P_PAREN_R))
+            if (is_puncid(peek(0), P_PAREN_R))
             {
-                free_token(&tk);
+                consume();
             }
             else
             {
-                pushback(tk);
                 // error
             }
 
             node->true_stmt = make_statement(in_switch);
 
-            tk = next();
-            if (is_keyword(tk, "else"))
+            if (is_keyword(peek(0), KW_ELSE))
             {
-                free_token(&tk);
+                consume();
                 node->false_stmt = make_statement(in_switch);
             }
-            else
-            {
-                pushback(tk);
-            }
             return node;
         }
         else
         {
-            pushback(tk);
             // error
         }
     }
-    else if (is_keyword(tk, "switch"))
+    else if (is_keyword(tk, KW_SWITCH))
     {
-        free_token(&tk);
+        consume();
         node = malloc_node(AST_SWITCH);
 
-        tk = next();
-        if (is_puncid(tk, P_PAREN_L))
+        if (is_puncid(peek(0), P_PAREN_L))
         {
-            free_token(&tk);
+            consume();
             node->switch_cond = make_exp();
 
-            tk = next();
-            if (is_puncid(tk, P_PAREN_R))
+            if (is_puncid(peek(0), P_PAREN_R))
             {
-                free_token(&tk);
+                consume();
                 node->switch_stmt = make_statement(true);
                 return node;
             }
             else
             {
-                pushback(tk);
                 // error
             }
         }
         else
         {
-            pushback(tk);
             // error
         }
     }
-    else
-    {
-        pushback(tk);
-    }
     return NULL;
 }
 
 static Node *
 make_iteration_stmt(bool in_switch)
 {
-    Token *tk;
+    const Lexeme *tk;
     Node *node;
 
-    tk = next();
-    if (is_keyword(tk, "while"))
+    tk = peek(0);
+    if (is_keyword(tk, KW_WHILE))
     {
-        free_token(&tk);
+        consume();
         node = malloc_node(AST_WHILE);
 
-        tk = next();
-        if (is_puncid(tk, P_PAREN_L))
+        if (is_puncid(peek(0), P_PAREN_L))
         {
-            free_token(&tk);
+            consume();
             node->while_cond = make_exp();
 
-            tk = next();
-            if (is_puncid(tk, P_PAREN_R))
+            if (is_puncid(peek(0), P_PAREN_R))
             {
-                free_token(&tk);
+                consume();
                 node->while_body = make_statement(in_switch);
                 return node;
             }
             else
             {
-                pushback(tk);
                 // error
             }
         }
         else
         {
-            pushback(tk);
             // error
         }
     }
-    else if (is_keyword(tk, "do"))
+    else if (is_keyword(tk, KW_DO))
     {
-        free_token(&tk);
+        consume();
         node = malloc_node(AST_DO);
         node->do_body = make_statement(in_switch);
 
-        tk = next();
-        if (is_keyword(tk, "while"))
+        if (is_keyword(peek(0), KW_WHILE))
         {
-            free_token(&tk);
-            tk = next();
-            if (is_puncid(tk, P_PAREN_L))
+            consume();
+            if (is_puncid(peek(0), P_PAREN_L))
             {
-                free_token(&tk);
+                consume();
                 node->do_body = make_exp();
-                tk = next();
-                if (is_puncid(tk, P_PAREN_R))
+                if (is_puncid(peek(0), P_PAREN_R))
                 {
-                    free_token(&tk);
-                    tk = next();
-                    if (is_puncid(tk, P_SCOLON))
+                    consume();
+                    if (is_puncid(peek(0), P_SCOLON))
                     {
-                        free_token(&tk);
+                        consume();
                         return node;
                     }
                     else
                     {
-                        pushback(tk);
                         // error
                     }
                 }
                 else
                 {
-                    pushback(tk);
                     // error
                 }
             }
             else
             {
-                pushback(tk);
                 // error
             }
         }
         else
         {
-            pushback(tk);
             // error
         }
     }
-    else if (is_keyword(tk, "for"))
+    else if (is_keyword(tk, KW_FOR))
     {
-        free_token(&tk);
+        consume();
         node = malloc_node(AST_FOR);
-        tk = next();
-        if (is_puncid(tk, P_PAREN_L))
+        if (is_puncid(peek(0), P_PAREN_L))
         {
-            free_token(&tk);
-            tk = next();
-            if (is_puncid(tk, P_SCOLON))
+            consume();
+            if (!is_puncid(peek(0), P_SCOLON))
             {
-                free_token(&tk);
-            }
-            else
-            {
-                pushback(tk);
                 node->for_init_exp = make_exp();
-                tk = next();
-                if (is_puncid(tk, P_SCOLON))
-                {
-                    free_token(&tk);
-                }
-                else
+                if (!is_puncid(peek(0), P_SCOLON))
                 {
-                    pushback(tk);
                     // error
                 }
             }
-            tk = next();
-            if (is_puncid(tk, P_SCOLON))
+            if (is_puncid(peek(0), P_SCOLON)) consume();
+            if (!is_puncid(peek(0), P_SCOLON))
             {
-                free_token(&tk);
-            }
-            else
-            {
-                pushback(tk);
                 node->for_cond_exp = make_exp();
-                tk = next();
-                if (is_puncid(tk, P_SCOLON))
-                {
-                    free_token(&tk);
-                }
-                else
+                if (!is_puncid(peek(0), P_SCOLON))
                 {
-                    pushback(tk);
                     // error
                 }
             }
+            if (is_puncid(peek(0), P_SCOLON)) consume();
             node->for_step_exp = make_exp();
-            tk = next();
-            if (is_puncid(tk, P_PAREN_R))
+            if (is_puncid(peek(0), P_PAREN_R))
             {
-                free_token(&tk);
+                consume();
                 node->for_body = make_statement(in_switch);
                 return node;
             }
             else
             {
-                pushback(tk);
                 // error
             }
         }
         else
         {
-            pushback(tk);
             // error
         }
     }
-    else
-    {
-        pushback(tk);
-    }
     return NULL;
 }
 
 static Node *
 make_jump_stmt(bool in_switch)
 {
-    Token *tk;
+    const Lexeme *tk;
     Node *node;
     
-    tk = next();
-    if (is_keyword(tk, "goto"))
+    tk = peek(0);
+    if (is_keyword(tk, KW_GOTO))
     {
-        free_token(&tk);
+        consume();
         node = malloc_node(AST_GOTO);
-        tk = next();
+        tk = peek(0);
         if (tk->kind == TK_IDENT)
         {
-            node->goto_label = new_string(tk->str);
-            free_token(&tk);
+            consume();
+            node->goto_label = tk->sym;
             return node;
         }
         else
         {
-            pushback(tk);
             // error
         }
     }
-    else if (is_keyword(tk, "continue"))
+    else if (is_keyword(tk, KW_CONTINUE))
     {
-        free_token(&tk);
+        consume();
         node = malloc_node(AST_CONTINUE);
         return node;
     }
-    else if (is_keyword(tk, "break"))
+    else if (is_keyword(tk, KW_BREAK))
     {
-        free_token(&tk);
+        consume();
         node = malloc_node(AST_BREAK);
         return node;
     }
-    else if (is_keyword(tk, "return"))
+    else if (is_keyword(tk, KW_RETURN))
     {
-        free_token(&tk);
+        consume();
         node = malloc_node(AST_RETURN);
-        tk = next();
-        if (is_puncid(tk, P_SCOLON))
+        if (is_puncid(peek(0), P_SCOLON))
         {
-            free_token(&tk);
+            consume();
         }
         else
         {
-            pushback(tk);
             node->return_exp = make_expression();
         }
         return node;
     }
-    else
-    {
-        pushback(tk);
-    }
 
     return NULL;
 }
@@ -1283,18 +997,23 @@ malloc_node(enum AST ast)
 
     switch (ast)
     {
+    case AST_IDENT:
+    case AST_CONSTANT:
+    case AST_STRING:
+        node->sym = SYM_NONE;
+        break;
     case AST_VAR_DECL:
-        node->name = NULL;
+        node->name = SYM_NONE;
         node->init_or_body = NULL;
         node->sc = SC_NONE;
         break;
     case AST_FUNC_DEF:
-        node->name = NULL;
+        node->name = SYM_NONE;
         node->init_or_body = NULL;
         node->sc = SC_NONE;
         break;
     case AST_LABEL:
-        node->label = NULL;
+        node->label = SYM_NONE;
         node->label_stmt = NULL;
         break;
     case AST_CASE:
@@ -1305,7 +1024,7 @@ malloc_node(enum AST ast)
         node->default_stmt = NULL;
         break;
     case AST_COMP_STMT:
-        node->stmts = NULL;
+        init_smallvec(&node->stmts);
         break;
     case AST_EXP_STMT:
         node->exp_stmt = NULL;
@@ -1334,7 +1053,7 @@ malloc_node(enum AST ast)
         node->for_body = NULL;
         break;
     case AST_GOTO:
-        node->goto_label = NULL;
+        node->goto_label = SYM_NONE;
         break;
     case AST_RETURN:
         node->return_exp = NULL;
@@ -1363,7 +1082,7 @@ malloc_type(enum TypeType tt)
         break;
     case TT_FUNCTION:
         t->ret = NULL;
-        t->args = NULL;
+        init_smallvec(&t->args);
         t->is_vargs = false;
         t->is_inline = false;
         break;
@@ -1398,7 +1117,7 @@ copy_type(const Type *t)
         break;
     case TT_FUNCTION:
         newt->ret = t->ret;
-        newt->args = t->args;
+        copy_smallvec(&newt->args, &t->args);
         newt->is_vargs = t->is_vargs;
         newt->is_inline = t->is_inline;
         break;
@@ -1416,42 +1135,56 @@ copy_type(const Type *t)
     return newt;
 }
 
-static void
-pushback(Token *tk) { add_list(stack, tk); }
+/*
+ * The token k places after the next one, which stays where it is:
+ * the lexer has put all the tokens in one array, so a production
+ * looks ahead at them without copying or allocating anything, and
+ * takes one with consume() only once it has decided on it. No
+ * production looks further than peek(1). TK_ENDFILE is returned
+ * again at the end.
+ */
+static const Lexeme *
+peek(int k)
+{
+    int i = tkpos + k;
+    return &tokens->v[(i < tokens->len) ? i : tokens->len-1];
+}
 
-static Token *
-next()
+/* Takes the next token */
+static const Lexeme *
+consume()
 {
-    if (stack->len != 0) return (Token*)pop_list(stack);
-    return next_token();
+    const Lexeme *tk = peek(0);
+    if (tkpos < tokens->len) tkpos++;
+    return tk;
 }
 
 static bool
-is_puncid(const Token *tk, enum PnctID id)
+is_puncid(const Lexeme *tk, enum PnctID id)
 {
     return tk->kind == TK_PUNCTUATOR && tk->id == id;
 }
 
 static bool
-is_keyword(const Token *tk, const char *p)
+is_keyword(const Lexeme *tk, enum KeywordID kw)
 {
-    return tk->kind == TK_KEYWORD && cmp2_string(tk->str, p) == 0;
+    return tk->kind == TK_KEYWORD && tk->kw == kw;
 }
 
 #ifdef TEST_LL_PARSER
 #define ARRAY_LEN(x) (sizeof((x))/sizeof(char))
-static void output_init(FILE *f);
-static void output_end(FILE *f);
-static void output_node(FILE *f, const Node *node, const char *parent, const char *edge);
-static void output_type(FILE *f, const Type *type, const char *parent, const char *edge);
+static void output_init(StrBuilder *b);
+static void output_end(StrBuilder *b);
+static void output_node(StrBuilder *b, const Node *node, const char *parent, const char *edge);
+static void output_type(StrBuilder *b, const Type *type, const char *parent, const char *edge);
 
 static void
-output_init(FILE *f) { fprintf(f, "digraph {\n"); }
+output_init(StrBuilder *b) { append3_builder(b, "digraph {\n"); }
 static void
-output_end(FILE *f) { fprintf(f, "}\n"); }
+output_end(StrBuilder *b) { append3_builder(b, "}\n"); }
 
 static void
-output_node(FILE *f, const Node *node, const char *parent, const char *edge)
+output_node(StrBuilder *b, const Node *node, const char *parent, const char *edge)
 {
     switch (node->kind)
     {
@@ -1459,7 +1192,7 @@ output_node(FILE *f, const Node *node, const char *parent, const char *edge)
     case AST_FUNC_DEF:
         {
             char *p = NULL, *t = NULL, str[256];
-            snprintf(str, ARRAY_LEN(str), "node_%s", node->name->str);
+            snprintf(str, ARRAY_LEN(str), "node_%s", symbol_string(node->name)->str);
 
             if (node->sc == SC_NONE)         p = "NONE";
             else if (node->sc == SC_TYPEDEF) p = "TYPEDEF";
@@ -1469,18 +1202,18 @@ output_node(FILE *f, const Node *node, const char *parent, const char *edge)
             if (node->kind == AST_VAR_DECL)      t = "VARDECL";
             else if (node->kind == AST_FUNC_DEF) t = "FUNCDEF";
 
-            fprintf(f, "%s [shape=box, label=\"%s\\nname=%s\\nsc=%s\"];\n",
-                    str, t, node->name->str, p);
+            format_builder(b, "%s [shape=box, label=\"%s\\nname=%s\\nsc=%s\"];\n",
+                    str, t, symbol_string(node->name)->str, p);
             if (parent != NULL)
             {
-                fprintf(f, "%s -> %s", parent, str);
+                format_builder(b, "%s -> %s", parent, str);
                 if (edge != NULL)
                 {
-                    fprintf(f, " [label=\"%s\"];", edge);
+                    format_builder(b, " [label=\"%s\"];", edge);
                 }
-                fprintf(f, "\n");
+                append2_builder(b, '\n');
             }
-            output_type(f, node->type, str, "Type");
+            output_type(b, node->type, str, "Type");
         }
         break;
     default:
@@ -1489,7 +1222,7 @@ output_node(FILE *f, const Node *node, const char *parent, const char *edge)
 }
 
 static void
-output_type(FILE *f, const Type *type, const char *parent, const char *edge)
+output_type(StrBuilder *b, const Type *type, const char *parent, const char *edge)
 {
     static unsigned int type_count = 0;
     char p[256];
@@ -1500,79 +1233,82 @@ output_type(FILE *f, const Type *type, const char *parent, const char *edge)
     {
     case TT_BASIC:
         {
-            fprintf(f, "%s [shape=box, label=\"%s,%d,%d\\nconst=%d\\nvolatile=%d\\nsigned=%d\"];\n",
+            format_builder(b, "%s [shape=box, label=\"%s,%d,%d\\nconst=%d\\nvolatile=%d\\nsigned=%d\"];\n",
                     p, "BASIC", type->size, type->align,
                     type->is_const, type->is_volatile, type->is_signed);
         }
         break;
     case TT_STRUCT_UNION:
         {
-            fprintf(f, "%s [shape=box, label=\"%s,%d,%d\\nconst=%d\\nvolatile=%d\\n\"];\n",
+            format_builder(b, "%s [shape=box, label=\"%s,%d,%d\\nconst=%d\\nvolatile=%d\\n\"];\n",
                     p, type->is_struct ? "STRUCT" : "UNION", type->size, type->align,
                     type->is_const, type->is_volatile);
         }
         break;
     case TT_POINTER:
         {
-            fprintf(f, "%s [shape=box, label=\"%s,%d,%d\\nconst=%d\\nvolatile=%d\\n\"];\n",
+            format_builder(b, "%s [shape=box, label=\"%s,%d,%d\\nconst=%d\\nvolatile=%d\\n\"];\n",
                     p, "POINTER", type->size, type->align,
                     type->is_const, type->is_volatile);
-            output_type(f, type->ptr, p, "ptr");
+            output_type(b, type->ptr, p, "ptr");
         }
         break;
     case TT_ARRAY:
         {
-            fprintf(f, "%s [shape=box, label=\"%s,%d,%d\\nconst=%d\\nvolatile=%d\\nstatic=%d\\nvarg=%d\\n\"];\n",
+            format_builder(b, "%s [shape=box, label=\"%s,%d,%d\\nconst=%d\\nvolatile=%d\\nstatic=%d\\nvarg=%d\\n\"];\n",
                     p, "ARRAY", type->size, type->align,
                     type->is_const, type->is_volatile, type->is_static, type->is_varray);
-            output_type(f, type->base, p, "base");
+            output_type(b, type->base, p, "base");
         }
         break;
     case TT_FUNCTION:
         {
-            iter_list iter;
-            fprintf(f, "%s [shape=box, label=\"%s,%d,%d\\nconst=%d\\nvolatile=%d\\nvargs=%d\\ninline=%d\"];\n",
+            iter_smallvec iter;
+            format_builder(b, "%s [shape=box, label=\"%s,%d,%d\\nconst=%d\\nvolatile=%d\\nvargs=%d\\ninline=%d\"];\n",
                     p, "FUNCTION", type->size, type->align,
                     type->is_const, type->is_volatile, type->is_vargs, type->is_inline);
-            output_type(f, type->ret, p, "ret");
-            if (type->args == NULL) break;
-            for (init_iter_list(type->args, &iter);
-                 hasnext_iter_list(&iter);
-                 next_iter_list(&iter))
+            output_type(b, type->ret, p, "ret");
+            for (init_iter_smallvec(&type->args, &iter);
+                 hasnext_iter_smallvec(&iter);
+                 next_iter_smallvec(&iter))
             {
-                output_node(f, ((Node*)value_iter_list(&iter)), p, "args");
+                output_node(b, ((Node*)value_iter_smallvec(&iter)), p, "args");
             }
         }
         break;
     }
-    fprintf(f, "%s -> %s [label=\"%s\"];\n", parent, p, edge);
+    format_builder(b, "%s -> %s [label=\"%s\"];\n", parent, p, edge);
 }
 
 int
 main(int argc, char *argv[])
 {
-    List *list;
+    Vec *list;
+    StrBuilder *b;
     FILE *file;
     char output[256];
-    iter_list iter;
+    iter_vec iter;
 
     init_parser(argv[1]);
     list = parse_top();
 
     snprintf(output, sizeof(output)/sizeof(char), "%s.dot", argv[1]);
     file = fopen(output, "w");
+    b = make_builder();
     {
-        output_init(file);
+        output_init(b);
 
-        for (init_iter_list(list, &iter);
-                hasnext_iter_list(&iter);
-                next_iter_list(&iter))
+        for (init_iter_vec(list, &iter);
+                hasnext_iter_vec(&iter);
+                next_iter_vec(&iter))
         {
-            output_node(file, (Node*)value_iter_list(&iter), NULL, NULL);
+            output_node(b, (Node*)value_iter_vec(&iter), NULL, NULL);
         }
 
-    } output_end(file);
+    } output_end(b);
 
+    flush_builder(b, fileno(file));
+    free_builder(&b);
     fclose(file);
     return EXIT_SUCCESS;
 }
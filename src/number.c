@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include "tilde.h"
+
+#define MAX_EXACT_POW10 (22)          // the largest power of 10 held exactly by a double
+#define MAX_EXACT_INT   (1ull << 53)  // integers up to this are exact in a double
+#define MAX_EXPONENT    (100000)      // beyond this every double is 0 or infinity
+#define BUFSIZE         (128)
+
+/*
+ * Numeric constants are decoded from the spelling the lexer has found.
+ * Most floating constants are short, and a double is then computed
+ * exactly from the digits and a power of 10, both of which are exact
+ * doubles, by one correctly rounded operation (Clinger's fast path).
+ * The others are left to strtod(), which rounds correctly too.
+ */
+static const double pow10[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static int  digit_value(int c);
+static bool well_formed(const char *s, const char *end, int base);
+static bool is_float(const char *s, const char *end, int base);
+static bool decode_integer(const char *s, const char *end, int base, Number *n);
+static bool decode_float(const char *s, const char *end, int base, Number *n);
+static bool fast_decimal(const char *s, const char *end, double *f);
+static bool fast_hex(const char *s, const char *end, double *f);
+static double slow_float(const char *s, const char *end, bool single);
+
+/*
+ * Decodes the constant of len bytes at s, which next_lexeme() has
+ * taken for an integer or floating constant.
+ * Returns NUM_RANGE if the value is out of the range of its type, and
+ * NUM_MALFORMED if digits are missing; n is given a value all the same.
+ */
+enum NumError
+decode_number(const char *s, size_t len, Number *n)
+{
+    const char *end = s + len;
+    int base = 10;
+    bool ok;
+
+    if (len >= 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+    {
+        base = 16;
+    }
+    if (is_float(s, end, base))
+    {
+        ok = decode_float(s, end, base, n);
+    }
+    else
+    {
+        ok = decode_integer(s, end, base, n);
+    }
+    if (!well_formed(s, end, base)) return NUM_MALFORMED;
+    return ok ? NUM_OK : NUM_RANGE;
+}
+
+static int
+digit_value(int c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/*
+ * Whether the constant has digits after its prefix, and after the e or
+ * p of its exponent; a hexadecimal floating constant needs an exponent.
+ */
+static bool
+well_formed(const char *s, const char *end, int base)
+{
+    bool dot = false;
+    int d, digits = 0;
+
+    if (base == 16) s += 2;
+    for (; s < end; s++)
+    {
+        if (*s == '.') dot = true;
+        else if ((d = digit_value(*s)) >= 0 && d < base) digits++;
+        else break;
+    }
+    if (digits == 0) return false;
+    if (s < end && ((base == 10 && (*s == 'e' || *s == 'E')) ||
+                    (base == 16 && (*s == 'p' || *s == 'P'))))
+    {
+        s++;
+        if (s < end && (*s == '+' || *s == '-')) s++;
+        return s < end && *s >= '0' && *s <= '9';
+    }
+    return !(base == 16 && dot);
+}
+
+static bool
+is_float(const char *s, const char *end, int base)
+{
+    for (; s < end; s++)
+    {
+        if (*s == '.') return true;
+        if (base == 10 && (*s == 'e' || *s == 'E')) return true;
+        if (base == 16 && (*s == 'p' || *s == 'P')) return true;
+    }
+    return false;
+}
+
+/* The type is the first of the C list for the base and suffix which holds the value */
+static bool
+decode_integer(const char *s, const char *end, int base, Number *n)
+{
+    unsigned long long v = 0;
+    bool overflow = false, is_unsigned = false, is_long = false;
+    int d;
+
+    if (base == 16) s += 2;
+    for (; s < end && (d = digit_value(*s)) >= 0 && d < base; s++)
+    {
+        if (v > (ULLONG_MAX - d) / base) overflow = true;
+        v = v * base + d;
+    }
+    for (; s < end; s++)
+    {
+        if (*s == 'u' || *s == 'U') is_unsigned = true;
+        if (*s == 'l' || *s == 'L') is_long = true;
+    }
+
+    if (overflow) v = ULLONG_MAX;
+    n->i = v;
+    if (is_unsigned)
+    {
+        n->type = (!is_long && v <= UINT_MAX) ? NT_UINT : NT_ULONG;
+    }
+    else if (!is_long && v <= INT_MAX)
+    {
+        n->type = NT_INT;
+    }
+    else if (!is_long && base == 16 && v <= UINT_MAX)
+    {
+        n->type = NT_UINT;
+    }
+    else
+    {
+        n->type = (v <= LONG_MAX) ? NT_LONG : NT_ULONG;
+    }
+    return !overflow;
+}
+
+static bool
+decode_float(const char *s, const char *end, int base, Number *n)
+{
+    double f;
+
+    n->type = NT_DOUBLE;
+    if (end[-1] == 'f' || end[-1] == 'F')
+    {
+        n->type = NT_FLOAT;
+        end--;
+    }
+    else if (end[-1] == 'l' || end[-1] == 'L')
+    {
+        n->type = NT_LDOUBLE;
+        end--;
+    }
+
+    // a float rounded from a rounded double might be off by one ulp
+    if (n->type == NT_FLOAT ||
+        !((base == 10) ? fast_decimal(s, end, &f) : fast_hex(s + 2, end, &f)))
+    {
+        f = slow_float(s, end, n->type == NT_FLOAT);
+    }
+    n->f = f;
+    return !isinf(f);
+}
+
+/* Clinger's fast path: succeeds if f can be computed exactly */
+static bool
+fast_decimal(const char *s, const char *end, double *f)
+{
+    unsigned long long w = 0;
+    int e10 = 0, exp = 0, sign = 1;
+    bool dot = false;
+
+    for (; s < end; s++)
+    {
+        if (*s == '.')
+        {
+            dot = true;
+        }
+        else if (*s >= '0' && *s <= '9')
+        {
+            if (w >= MAX_EXACT_INT / 10) return false;
+            w = w * 10 + (*s - '0');
+            if (dot) e10--;
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (s < end && (*s == 'e' || *s == 'E'))
+    {
+        s++;
+        if (s < end && (*s == '+' || *s == '-')) sign = (*s++ == '-') ? -1 : 1;
+        for (; s < end && *s >= '0' && *s <= '9'; s++)
+        {
+            if (exp < MAX_EXPONENT) exp = exp * 10 + (*s - '0');
+        }
+        e10 += sign * exp;
+    }
+
+    if (w == 0)
+    {
+        *f = 0.0;
+        return true;
+    }
+    if (e10 < -MAX_EXACT_POW10) return false;
+    if (e10 < 0)
+    {
+        *f = (double)w / pow10[-e10];
+        return true;
+    }
+    // move the surplus of the exponent into w while it stays exact
+    for (; e10 > MAX_EXACT_POW10; e10--)
+    {
+        if (w > MAX_EXACT_INT / 10) return false;
+        w *= 10;
+    }
+    *f = (double)w * pow10[e10];
+    return true;
+}
+
+/* A hexadecimal mantissa of 53 bits at most is scaled exactly by ldexp() */
+static bool
+fast_hex(const char *s, const char *end, double *f)
+{
+    unsigned long long w = 0;
+    int e2 = 0, exp = 0, sign = 1, d;
+    bool dot = false;
+
+    for (; s < end; s++)
+    {
+        if (*s == '.')
+        {
+            dot = true;
+        }
+        else if ((d = digit_value(*s)) >= 0)
+        {
+            if (w >= MAX_EXACT_INT / 16) return false;
+            w = w * 16 + d;
+            if (dot) e2 -= 4;
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (s < end && (*s == 'p' || *s == 'P'))
+    {
+        s++;
+        if (s < end && (*s == '+' || *s == '-')) sign = (*s++ == '-') ? -1 : 1;
+        for (; s < end && *s >= '0' && *s <= '9'; s++)
+        {
+            if (exp < MAX_EXPONENT) exp = exp * 10 + (*s - '0');
+        }
+        e2 += sign * exp;
+    }
+    *f = ldexp((double)w, e2);
+    return true;
+}
+
+static double
+slow_float(const char *s, const char *end, bool single)
+{
+    char buf[BUFSIZE], *p = buf;
+    size_t len = end - s;
+    double f;
+
+    // the spelling is not terminated where the constant ends
+    if (len >= BUFSIZE) p = (char*)try_malloc(len + 1);
+    memcpy(p, s, len);
+    p[len] = '\0';
+    f = single ? strtof(p, NULL) : strtod(p, NULL);
+    if (p != buf) free(p);
+    return f;
+}
+
+#ifdef TEST_NUMBER
+int
+main(int argc, char *argv[])
+{
+    static const char *ints[] =
+    {
+        "0", "2147483647", "2147483648", "0x7fffffff", "0x80000000", "0xffffffffu",
+        "0x100000000u", "9223372036854775807", "9223372036854775808", "1l", "1lu",
+        "18446744073709551615", "18446744073709551616", "0xFFFFFFFFFFFFFFFFF",
+    };
+    static const enum NumType types[] =
+    {
+        NT_INT, NT_INT, NT_LONG, NT_INT, NT_UINT, NT_UINT,
+        NT_ULONG, NT_LONG, NT_ULONG, NT_LONG, NT_ULONG,
+        NT_ULONG, NT_ULONG, NT_ULONG,
+    };
+    static const char *malformed[] =
+    {
+        "0x", "0Xu", "0x.p1", "1e", "1e+", "2.5E-f", "0x1p", "0x1.8",
+    };
+    static const char digits[] = "0123456789";
+    const int TRIES = 200000;
+    char buf[64];
+    Number n;
+    double f;
+    bool ok;
+    int i, j, len, failed = 0;
+
+    for (i = 0; i < (int)(sizeof(ints) / sizeof(ints[0])); ++i)
+    {
+        ok = (decode_number(ints[i], strlen(ints[i]), &n) == NUM_OK);
+        if (n.type != types[i] || ok != (i < 12) ||
+            (ok && n.i != strtoull(ints[i], NULL, 0)))
+        {
+            printf("%s\n", ints[i]);
+            failed++;
+        }
+    }
+
+    // the fast paths must agree with strtod() to the bit
+    srand(1);
+    for (i = 0; i < TRIES; ++i)
+    {
+        if (i % 2 == 0)
+        {
+            len = 2 + rand() % 17;  // a digit is left beside the point
+            for (j = 0; j < len; ++j) buf[j] = digits[rand() % 10];
+            j = rand() % (len + 1);
+            buf[j] = '.';
+            if (j == len) len++;
+            len += sprintf(buf + len, "e%d", rand() % 700 - 350);
+        }
+        else
+        {
+            len = sprintf(buf, "0x%x.%xp%d", rand(), rand() % 4096, rand() % 2200 - 1100);
+        }
+        buf[len] = '\0';
+        ok = (decode_number(buf, len, &n) == NUM_OK);
+        f = strtod(buf, NULL);
+        if (n.type != NT_DOUBLE || memcmp(&n.f, &f, sizeof(f)) != 0 || ok == isinf(f))
+        {
+            printf("%s\n", buf);
+            failed++;
+        }
+    }
+    if (decode_number("1e999", 5, &n) != NUM_RANGE || decode_number("0x1p1024", 8, &n) != NUM_RANGE) failed++;
+    if (decode_number("1.5f", 4, &n) != NUM_OK || n.type != NT_FLOAT || n.f != 1.5) failed++;
+
+    // digits missing after the prefix or in the exponent
+    for (i = 0; i < (int)(sizeof(malformed) / sizeof(malformed[0])); ++i)
+    {
+        if (decode_number(malformed[i], strlen(malformed[i]), &n) != NUM_MALFORMED)
+        {
+            printf("%s\n", malformed[i]);
+            failed++;
+        }
+    }
+    if (decode_number("0x1.8p+1", 8, &n) != NUM_OK || n.f != 3.0) failed++;
+    if (decode_number("1e-2f", 5, &n) != NUM_OK || n.type != NT_FLOAT) failed++;
+
+    // if correct, print 0
+    printf("%d\n", failed);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
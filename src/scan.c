@@ -0,0 +1,773 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tilde.h"
+
+/*
+ * Byte scanners used by the lexer to run over blanks, comments,
+ * identifiers and digit sequences many bytes at a time, and by the
+ * source manager to find the newlines of a file. Every scanner stops
+ * at a '\0' or at the given end, so it never runs past the sentinel of
+ * the source buffer, but it may load up to SCAN_PADDING bytes beyond it.
+ *
+ * On x86 the SSE2 versions are the baseline and the AVX2 versions are
+ * chosen at program start if the CPU supports them, so the scanners
+ * can be called from any thread without further synchronization.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef const char *(*find_fn)(const char *p);
+typedef size_t (*index_fn)(const char *p, size_t len, unsigned int *heads);
+typedef size_t (*validate_fn)(const char *p, size_t len);
+
+const unsigned char char_class[256] =
+{
+    [' ']  = CC_SPACE,  ['\t'] = CC_SPACE,  ['\v'] = CC_SPACE,
+    ['\n'] = CC_RETURN, ['\r'] = CC_RETURN,
+    ['0' ... '7'] = CC_DIGIT | CC_OCT | CC_HEX,
+    ['8' ... '9'] = CC_DIGIT | CC_HEX,
+    ['A' ... 'F'] = CC_NONDIGIT | CC_HEX,
+    ['a' ... 'f'] = CC_NONDIGIT | CC_HEX,
+    ['G' ... 'Z'] = CC_NONDIGIT,
+    ['g' ... 'z'] = CC_NONDIGIT,
+    ['_'] = CC_NONDIGIT,
+};
+
+/* prototypes */
+static void select_impl() __attribute__((constructor));
+
+#if !defined(SCAN_X86) || defined(TEST_SCAN)
+static const char *skip_blank_scalar(const char *p);
+static const char *find_comment_end_scalar(const char *p);
+static const char *find_eol_scalar(const char *p);
+static const char *skip_ident_scalar(const char *p);
+static const char *skip_digit_scalar(const char *p);
+static const char *skip_xdigit_scalar(const char *p);
+static size_t index_lines_scalar(const char *p, size_t len, unsigned int *heads);
+#endif
+static size_t validate_utf8_scalar(const char *p, size_t len);
+#ifdef SCAN_X86
+static size_t resume_utf8(const char *p, size_t len, size_t i);
+#endif
+
+static find_fn skip_blank_impl;
+static find_fn find_comment_end_impl;
+static find_fn find_eol_impl;
+static find_fn skip_ident_impl;
+static find_fn skip_digit_impl;
+static find_fn skip_xdigit_impl;
+static index_fn index_lines_impl;
+static validate_fn validate_utf8_impl;
+
+/* Returns the first byte which is not one of " \t\v\r\n". */
+const char *
+skip_blank(const char *p)
+{
+    return skip_blank_impl(p);
+}
+
+/* Returns the '*' of the first "*\/" or the first '\0'. */
+const char *
+find_comment_end(const char *p)
+{
+    return find_comment_end_impl(p);
+}
+
+/* Returns the first '\n', '\r' or '\0'. */
+const char *
+find_eol(const char *p)
+{
+    return find_eol_impl(p);
+}
+
+/* Returns the first byte which is not a letter, digit or '_'. */
+const char *
+skip_ident(const char *p)
+{
+    return skip_ident_impl(p);
+}
+
+/* Returns the first byte which is not a digit of base 10 or 16. */
+const char *
+skip_digit(const char *p, int base)
+{
+    return (base == 16) ? skip_xdigit_impl(p) : skip_digit_impl(p);
+}
+
+/*
+ * Stores the offset of the byte after each '\n' of the len bytes at p
+ * in heads, unless heads is NULL, and returns the number of them.
+ * '\0' does not stop this scanner.
+ */
+size_t
+index_lines(const char *p, size_t len, unsigned int *heads)
+{
+    return index_lines_impl(p, len, heads);
+}
+
+/*
+ * Returns the offset of the first sequence of the len bytes at p which
+ * is not well formed UTF-8, or len if there is none. '\0' does not stop
+ * this scanner, and text in ASCII is passed over a vector at a time.
+ */
+size_t
+validate_utf8(const char *p, size_t len)
+{
+    return validate_utf8_impl(p, len);
+}
+
+#if !defined(SCAN_X86) || defined(TEST_SCAN)
+static const char *
+skip_blank_scalar(const char *p)
+{
+    for (; char_class[(unsigned char)*p] & (CC_SPACE | CC_RETURN); p++);
+    return p;
+}
+
+static const char *
+find_comment_end_scalar(const char *p)
+{
+    for (;; p++)
+    {
+        if (*p == '*')
+        {
+            if (p[1] == '/') return p;
+        }
+        else if (*p == '\0')
+        {
+            return p;
+        }
+    }
+}
+
+static const char *
+find_eol_scalar(const char *p)
+{
+    for (; *p != '\n' && *p != '\r' && *p != '\0'; p++);
+    return p;
+}
+
+static const char *
+skip_ident_scalar(const char *p)
+{
+    for (; char_class[(unsigned char)*p] & (CC_NONDIGIT | CC_DIGIT); p++);
+    return p;
+}
+
+static const char *
+skip_digit_scalar(const char *p)
+{
+    for (; char_class[(unsigned char)*p] & CC_DIGIT; p++);
+    return p;
+}
+
+static const char *
+skip_xdigit_scalar(const char *p)
+{
+    for (; char_class[(unsigned char)*p] & CC_HEX; p++);
+    return p;
+}
+
+static size_t
+index_lines_scalar(const char *p, size_t len, unsigned int *heads)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < len; i++)
+    {
+        if (p[i] != '\n') continue;
+        if (heads != NULL) heads[n] = (unsigned int)(i + 1);
+        n++;
+    }
+    return n;
+}
+#endif
+
+/* The sequences are those which decode_utf8() takes, so the two agree */
+static size_t
+validate_utf8_scalar(const char *p, size_t len)
+{
+    unsigned int cp;
+    size_t i = 0;
+    int n;
+
+    while (i < len)
+    {
+        n = decode_utf8(p + i, len - i, &cp);
+        if (n == 0) return i;
+        i += n;
+    }
+    return len;
+}
+
+#ifdef SCAN_X86
+/*
+ * Goes on with the scalar validator at i, when all the sequences which
+ * end before i are well formed; one of the last 3 bytes may begin a
+ * sequence which goes on past i.
+ */
+static size_t
+resume_utf8(const char *p, size_t len, size_t i)
+{
+    size_t k = (i < 3) ? 0 : i - 3;
+
+    for (; k < i && ((unsigned char)p[k] & 0xc0) == 0x80; k++);
+    return k + validate_utf8_scalar(p + k, len - k);
+}
+
+/* stores the heads of the lines which begin after the newlines marked in mask */
+static inline size_t
+store_heads(size_t off, unsigned int mask, unsigned int *heads)
+{
+    size_t n = 0;
+
+    if (heads == NULL) return __builtin_popcount(mask);
+    for (; mask != 0; mask &= mask - 1)
+    {
+        heads[n++] = (unsigned int)(off + __builtin_ctz(mask) + 1);
+    }
+    return n;
+}
+
+static const char *
+skip_blank_sse2(const char *p)
+{
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i ht = _mm_set1_epi8('\t');
+    const __m128i vt = _mm_set1_epi8('\v');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    unsigned int blank;
+    __m128i v;
+
+    for (;; p += 16)
+    {
+        v = _mm_loadu_si128((const __m128i*)p);
+        blank = _mm_movemask_epi8(_mm_or_si128(
+                    _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, ht)),
+                                _mm_or_si128(_mm_cmpeq_epi8(v, vt), _mm_cmpeq_epi8(v, cr))),
+                    _mm_cmpeq_epi8(v, lf)));
+        if (blank != 0xffff) return p + __builtin_ctz(~blank);
+    }
+}
+
+static const char *
+find_comment_end_sse2(const char *p)
+{
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i nul = _mm_setzero_si128();
+    unsigned int end;
+    __m128i a, b;
+
+    for (;; p += 16)
+    {
+        a = _mm_loadu_si128((const __m128i*)p);
+        b = _mm_loadu_si128((const __m128i*)(p+1));
+        end = _mm_movemask_epi8(_mm_or_si128(
+                    _mm_and_si128(_mm_cmpeq_epi8(a, star), _mm_cmpeq_epi8(b, slash)),
+                    _mm_cmpeq_epi8(a, nul)));
+        if (end != 0) return p + __builtin_ctz(end);
+    }
+}
+
+static const char *
+find_eol_sse2(const char *p)
+{
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i nul = _mm_setzero_si128();
+    unsigned int end;
+    __m128i v;
+
+    for (;; p += 16)
+    {
+        v = _mm_loadu_si128((const __m128i*)p);
+        end = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(
+                    _mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)),
+                    _mm_cmpeq_epi8(v, nul)));
+        if (end != 0) return p + __builtin_ctz(end);
+    }
+}
+
+/* bytes of v in [lo, hi] */
+static inline __m128i
+in_range_sse2(__m128i v, char lo, char hi)
+{
+    v = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - lo)));
+    return _mm_cmplt_epi8(v, _mm_set1_epi8((char)(0x80 + (hi - lo + 1))));
+}
+
+static const char *
+skip_ident_sse2(const char *p)
+{
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i under = _mm_set1_epi8('_');
+    unsigned int m;
+    __m128i v, id;
+
+    for (;; p += 16)
+    {
+        v = _mm_loadu_si128((const __m128i*)p);
+        id = _mm_or_si128(_mm_or_si128(
+                    in_range_sse2(_mm_or_si128(v, lower), 'a', 'z'),
+                    in_range_sse2(v, '0', '9')),
+                    _mm_cmpeq_epi8(v, under));
+        m = _mm_movemask_epi8(id);
+        if (m != 0xffff) return p + __builtin_ctz(~m);
+    }
+}
+
+static const char *
+skip_digit_sse2(const char *p)
+{
+    unsigned int m;
+
+    for (;; p += 16)
+    {
+        m = _mm_movemask_epi8(in_range_sse2(_mm_loadu_si128((const __m128i*)p), '0', '9'));
+        if (m != 0xffff) return p + __builtin_ctz(~m);
+    }
+}
+
+static const char *
+skip_xdigit_sse2(const char *p)
+{
+    const __m128i lower = _mm_set1_epi8(0x20);
+    unsigned int m;
+    __m128i v;
+
+    for (;; p += 16)
+    {
+        v = _mm_loadu_si128((const __m128i*)p);
+        m = _mm_movemask_epi8(_mm_or_si128(
+                    in_range_sse2(v, '0', '9'),
+                    in_range_sse2(_mm_or_si128(v, lower), 'a', 'f')));
+        if (m != 0xffff) return p + __builtin_ctz(~m);
+    }
+}
+
+static size_t
+index_lines_sse2(const char *p, size_t len, unsigned int *heads)
+{
+    const __m128i lf = _mm_set1_epi8('\n');
+    unsigned int m;
+    size_t i, n = 0;
+
+    for (i = 0; i < len; i += 16)
+    {
+        m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p+i)), lf));
+        if (len - i < 16) m &= (1u << (len - i)) - 1;
+        n += store_heads(i, m, (heads == NULL) ? NULL : heads + n);
+    }
+    return n;
+}
+
+/* ASCII is passed 16 bytes at a time, the rest a sequence at a time */
+static size_t
+validate_utf8_sse2(const char *p, size_t len)
+{
+    unsigned int m, cp;
+    size_t i = 0;
+    int n;
+
+    while (i < len)
+    {
+        if (i + 16 <= len)
+        {
+            m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p+i)));
+            if (m == 0)
+            {
+                i += 16;
+                continue;
+            }
+            i += __builtin_ctz(m);
+        }
+        n = decode_utf8(p + i, len - i, &cp);
+        if (n == 0) return i;
+        i += n;
+    }
+    return len;
+}
+
+__attribute__((target("avx2")))
+static const char *
+skip_blank_avx2(const char *p)
+{
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i ht = _mm256_set1_epi8('\t');
+    const __m256i vt = _mm256_set1_epi8('\v');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    unsigned int blank;
+    __m256i v;
+
+    for (;; p += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i*)p);
+        blank = _mm256_movemask_epi8(_mm256_or_si256(
+                    _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, ht)),
+                                _mm256_or_si256(_mm256_cmpeq_epi8(v, vt), _mm256_cmpeq_epi8(v, cr))),
+                    _mm256_cmpeq_epi8(v, lf)));
+        if (blank != 0xffffffffu) return p + __builtin_ctz(~blank);
+    }
+}
+
+__attribute__((target("avx2")))
+static const char *
+find_comment_end_avx2(const char *p)
+{
+    const __m256i star = _mm256_set1_epi8('*');
+    const __m256i slash = _mm256_set1_epi8('/');
+    const __m256i nul = _mm256_setzero_si256();
+    unsigned int end;
+    __m256i a, b;
+
+    for (;; p += 32)
+    {
+        a = _mm256_loadu_si256((const __m256i*)p);
+        b = _mm256_loadu_si256((const __m256i*)(p+1));
+        end = _mm256_movemask_epi8(_mm256_or_si256(
+                    _mm256_and_si256(_mm256_cmpeq_epi8(a, star), _mm256_cmpeq_epi8(b, slash)),
+                    _mm256_cmpeq_epi8(a, nul)));
+        if (end != 0) return p + __builtin_ctz(end);
+    }
+}
+
+__attribute__((target("avx2")))
+static const char *
+find_eol_avx2(const char *p)
+{
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i nul = _mm256_setzero_si256();
+    unsigned int end;
+    __m256i v;
+
+    for (;; p += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i*)p);
+        end = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(
+                    _mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr)),
+                    _mm256_cmpeq_epi8(v, nul)));
+        if (end != 0) return p + __builtin_ctz(end);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+in_range_avx2(__m256i v, char lo, char hi)
+{
+    v = _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - lo)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + (hi - lo + 1))), v);
+}
+
+__attribute__((target("avx2")))
+static const char *
+skip_ident_avx2(const char *p)
+{
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    const __m256i under = _mm256_set1_epi8('_');
+    unsigned int m;
+    __m256i v, id;
+
+    for (;; p += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i*)p);
+        id = _mm256_or_si256(_mm256_or_si256(
+                    in_range_avx2(_mm256_or_si256(v, lower), 'a', 'z'),
+                    in_range_avx2(v, '0', '9')),
+                    _mm256_cmpeq_epi8(v, under));
+        m = _mm256_movemask_epi8(id);
+        if (m != 0xffffffffu) return p + __builtin_ctz(~m);
+    }
+}
+
+__attribute__((target("avx2")))
+static const char *
+skip_digit_avx2(const char *p)
+{
+    unsigned int m;
+
+    for (;; p += 32)
+    {
+        m = _mm256_movemask_epi8(in_range_avx2(_mm256_loadu_si256((const __m256i*)p), '0', '9'));
+        if (m != 0xffffffffu) return p + __builtin_ctz(~m);
+    }
+}
+
+__attribute__((target("avx2")))
+static const char *
+skip_xdigit_avx2(const char *p)
+{
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    unsigned int m;
+    __m256i v;
+
+    for (;; p += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i*)p);
+        m = _mm256_movemask_epi8(_mm256_or_si256(
+                    in_range_avx2(v, '0', '9'),
+                    in_range_avx2(_mm256_or_si256(v, lower), 'a', 'f')));
+        if (m != 0xffffffffu) return p + __builtin_ctz(~m);
+    }
+}
+
+__attribute__((target("avx2")))
+static size_t
+index_lines_avx2(const char *p, size_t len, unsigned int *heads)
+{
+    const __m256i lf = _mm256_set1_epi8('\n');
+    unsigned int m;
+    size_t i, n = 0;
+
+    for (i = 0; i < len; i += 32)
+    {
+        m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p+i)), lf));
+        if (len - i < 32) m &= (1u << (len - i)) - 1;
+        n += store_heads(i, m, (heads == NULL) ? NULL : heads + n);
+    }
+    return n;
+}
+
+/*
+ * Classes of the errors of a pair of bytes, after "Validating UTF-8 in
+ * less than one instruction per byte" by Keiser and Lemire: each table
+ * gives the errors which a nibble of the pair allows, and the pair has
+ * one if all three allow it.
+ */
+#define U8_TOO_SHORT  (1 << 0) // 11______ 0_______ or 11______ 11______
+#define U8_TOO_LONG   (1 << 1) // 0_______ 10______
+#define U8_OVERLONG_3 (1 << 2) // 11100000 100_____
+#define U8_TOO_LARGE  (1 << 3) // 11110100 1001____ and above
+#define U8_SURROGATE  (1 << 4) // 11101101 101_____
+#define U8_OVERLONG_2 (1 << 5) // 1100000_ 10______
+#define U8_TOO_LARGE_1000 (1 << 6) // 11110101 1000____ and above
+#define U8_OVERLONG_4 (1 << 6) // 11110000 1000____
+#define U8_TWO_CONTS  (1 << 7) // 10______ 10______, unless the lead allows it
+#define U8_CARRY      (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+static const unsigned char u8_byte1_high[16] =
+{
+    U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+    U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+    U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+    U8_TOO_SHORT | U8_OVERLONG_2,
+    U8_TOO_SHORT,
+    U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+    U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+};
+
+static const unsigned char u8_byte1_low[16] =
+{
+    U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,
+    U8_CARRY | U8_OVERLONG_2,
+    U8_CARRY,
+    U8_CARRY,
+    U8_CARRY | U8_TOO_LARGE,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+};
+
+static const unsigned char u8_byte2_high[16] =
+{
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+};
+
+/* the bytes of v preceded by the last n of prev */
+#define PREV_AVX2(v, prev, n) \
+    _mm256_alignr_epi8((v), _mm256_permute2x128_si256((prev), (v), 0x21), 16 - (n))
+
+__attribute__((target("avx2")))
+static inline __m256i
+lookup_avx2(const unsigned char *table, __m256i nibbles)
+{
+    return _mm256_shuffle_epi8(
+            _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)table)), nibbles);
+}
+
+/*
+ * 32 bytes at a time, with the 3 bytes before them. A vector in ASCII
+ * only has to complete the sequences of the one before. The offset of
+ * an error is left to the scalar validator.
+ */
+__attribute__((target("avx2")))
+static size_t
+validate_utf8_avx2(const char *p, size_t len)
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i max = _mm256_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+    __m256i v, prev = _mm256_setzero_si256(), incomplete = _mm256_setzero_si256();
+    __m256i prev1, sc, must23, error;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i*)(p+i));
+        if (_mm256_movemask_epi8(v) == 0)
+        {
+            error = incomplete;
+        }
+        else
+        {
+            prev1 = PREV_AVX2(v, prev, 1);
+            sc = _mm256_and_si256(_mm256_and_si256(
+                        lookup_avx2(u8_byte1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                        lookup_avx2(u8_byte1_low, _mm256_and_si256(prev1, nibble))),
+                        lookup_avx2(u8_byte2_high, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+            // the third and fourth bytes of a sequence must be continuations, and only they
+            must23 = _mm256_or_si256(
+                        _mm256_subs_epu8(PREV_AVX2(v, prev, 2), _mm256_set1_epi8((char)(0xe0 - 0x80))),
+                        _mm256_subs_epu8(PREV_AVX2(v, prev, 3), _mm256_set1_epi8((char)(0xf0 - 0x80))));
+            error = _mm256_xor_si256(_mm256_and_si256(must23, _mm256_set1_epi8((char)0x80)), sc);
+        }
+        if (!_mm256_testz_si256(error, error)) return resume_utf8(p, len, i);
+        incomplete = _mm256_subs_epu8(v, max);
+        prev = v;
+    }
+    return resume_utf8(p, len, i);
+}
+#endif
+
+static void
+select_impl()
+{
+#ifdef SCAN_X86
+    if (__builtin_cpu_supports("avx2"))
+    {
+        skip_blank_impl = skip_blank_avx2;
+        find_comment_end_impl = find_comment_end_avx2;
+        find_eol_impl = find_eol_avx2;
+        skip_ident_impl = skip_ident_avx2;
+        skip_digit_impl = skip_digit_avx2;
+        skip_xdigit_impl = skip_xdigit_avx2;
+        index_lines_impl = index_lines_avx2;
+        validate_utf8_impl = validate_utf8_avx2;
+    }
+    else
+    {
+        skip_blank_impl = skip_blank_sse2;
+        find_comment_end_impl = find_comment_end_sse2;
+        find_eol_impl = find_eol_sse2;
+        skip_ident_impl = skip_ident_sse2;
+        skip_digit_impl = skip_digit_sse2;
+        skip_xdigit_impl = skip_xdigit_sse2;
+        index_lines_impl = index_lines_sse2;
+        validate_utf8_impl = validate_utf8_sse2;
+    }
+#else
+    skip_blank_impl = skip_blank_scalar;
+    find_comment_end_impl = find_comment_end_scalar;
+    find_eol_impl = find_eol_scalar;
+    skip_ident_impl = skip_ident_scalar;
+    skip_digit_impl = skip_digit_scalar;
+    skip_xdigit_impl = skip_xdigit_scalar;
+    index_lines_impl = index_lines_scalar;
+    validate_utf8_impl = validate_utf8_scalar;
+#endif
+}
+
+#ifdef TEST_SCAN
+int
+main(int argc, char *argv[])
+{
+    static const char alphabet[] = "  \t\n\n\r\v*/abzAFZ_09fG@[`{\x80\xff";
+    // mostly well formed UTF-8, with now and then a byte out of place
+    static const char *pieces[] =
+    {
+        "a", "a", "a", "a", "a", "a", "a", "a", "\xc3\xa9", "\xe4\xb8\x80", "\xf0\x9f\x98\x80",
+        "\xef\xbf\xbf", "\xf4\x8f\xbf\xbf", "\xed\x9f\xbf", "\xe0\xa0\x80", "\xc2\x80",
+    };
+    static const char strays[] = "\x80\xbf\xc0\xc1\xc2\xe0\xed\xf0\xf4\xf5\xff";
+    const int LEN = 256, TRIES = 100000;
+    char *buf;
+    unsigned int heads1[LEN], heads2[LEN];
+    size_t n1, n2;
+    int i, j, k, failed = 0;
+
+    buf = (char*)try_calloc(LEN + 1 + SCAN_PADDING, 1);
+    srand(1);
+    for (i = 0; i < TRIES; ++i)
+    {
+#ifdef SCAN_X86
+        // test the SSE2 versions in the second half
+        if (i == TRIES/2)
+        {
+            skip_blank_impl = skip_blank_sse2;
+            find_comment_end_impl = find_comment_end_sse2;
+            find_eol_impl = find_eol_sse2;
+            skip_ident_impl = skip_ident_sse2;
+            skip_digit_impl = skip_digit_sse2;
+            skip_xdigit_impl = skip_xdigit_sse2;
+            index_lines_impl = index_lines_sse2;
+            validate_utf8_impl = validate_utf8_sse2;
+        }
+#endif
+        for (j = 0; j < LEN; ++j)
+        {
+            buf[j] = alphabet[rand() % (sizeof(alphabet)-1)];
+        }
+        buf[rand() % (LEN+1)] = '\0';
+
+        if (skip_blank(buf) != skip_blank_scalar(buf)) failed++;
+        if (find_comment_end(buf) != find_comment_end_scalar(buf)) failed++;
+
+        j = rand() % (LEN+1);
+        n1 = index_lines(buf, j, heads1);
+        n2 = index_lines_scalar(buf, j, heads2);
+        if (n1 != n2 || memcmp(heads1, heads2, n1 * sizeof(unsigned int)) != 0) failed++;
+        if (index_lines(buf, j, NULL) != n2) failed++;
+
+        if (find_eol(buf) != find_eol_scalar(buf)) failed++;
+        for (j = 0; j < LEN; j += 8)
+        {
+            if (skip_ident(buf+j) != skip_ident_scalar(buf+j)) failed++;
+            if (skip_digit(buf+j, 10) != skip_digit_scalar(buf+j)) failed++;
+            if (skip_digit(buf+j, 16) != skip_xdigit_scalar(buf+j)) failed++;
+        }
+
+        for (j = 0; j < LEN; j += k)
+        {
+            const char *s = pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+            k = (int)strlen(s);
+            if (j + k > LEN) k = LEN - j;
+            memcpy(buf + j, s, k);
+        }
+        for (j = rand() % 3; j > 0; --j)
+        {
+            buf[rand() % LEN] = strays[rand() % (sizeof(strays)-1)];
+        }
+        j = rand() % LEN;
+        k = rand() % (LEN - j + 1);
+        if (validate_utf8(buf+j, k) != validate_utf8_scalar(buf+j, k)) failed++;
+    }
+
+    // if correct, print 0
+    printf("%d\n", failed);
+    free(buf);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
@@ -0,0 +1,494 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tilde.h"
+
+#define READ_CHUNK (64*1024)
+#define STREAM_WINDOW (128*1024)  // initial size of the window of a stream
+#define LOC_LIMIT  (1ull << 32)
+
+/*
+ * The source manager owns the text of every file and gives each file
+ * a range of locations of its own: a location is the base of a file
+ * plus an offset in it, so one 32-bit number names any byte of any
+ * file, and the end of each file as well.
+ *
+ * Lines are not counted while lexing. The heads of the lines of a file
+ * are found the first time one of its locations is decoded, and a
+ * location is then turned into a line by binary search.
+ * A manager can be shared by lexers running on different threads.
+ *
+ * The text of a file can be edited. The file keeps its base while its
+ * new text fits before the base of the next file, and is given a new
+ * base after all the files otherwise, so that ids never change.
+ *
+ * A stream, such as a pipe, is read through a window instead, which
+ * only holds the text from the lexeme being lexed on. Only the
+ * locations in the window can be decoded, so the line and column of a
+ * lexeme must be found before the window moves past it.
+ */
+typedef struct
+{
+    char *name;
+    char *text;            /* followed by '\0' and SCAN_PADDING readable bytes */
+    size_t len;
+    size_t mapsize;        /* 0 if text was malloc'ed */
+    SrcLoc base;
+    unsigned int *heads;   /* offsets in text of the heads of the lines but the first */
+    size_t nheads;
+    bool indexed;
+    int fd;                /* of a stream, or -1 */
+    bool eof;
+    size_t size;           /* of the window of a stream */
+    size_t winoff;         /* offset of text in the stream, 0 for a file */
+    unsigned int winline;  /* line of text[0] */
+    size_t winhead;        /* offset of the head of that line */
+} Source;
+
+struct SourceManager
+{
+    Source **files;        /* by id */
+    Source **order;        /* in the order of their bases */
+    int len;
+    int size;
+    unsigned long long next; /* base of the next file */
+    pthread_mutex_t lock;
+};
+
+static bool map_source(Source *src, int fd, size_t size);
+static bool read_source(Source *src, int fd);
+static int find_order(const SourceManager *sm, SrcLoc loc);
+static Source *find_source(const SourceManager *sm, SrcLoc loc);
+static void release_text(Source *src);
+static void init_window(Source *src);
+static int  add_source(SourceManager *sm, Source *src, const char *name);
+
+SourceManager *
+make_source_manager()
+{
+    SourceManager *sm = (SourceManager*)try_malloc(sizeof(SourceManager));
+    sm->len = 0;
+    sm->size = 4;
+    sm->files = (Source**)try_malloc(sizeof(Source*) * sm->size);
+    sm->order = (Source**)try_malloc(sizeof(Source*) * sm->size);
+    sm->next = 0;
+    pthread_mutex_init(&sm->lock, NULL);
+    return sm;
+}
+
+void
+free_source_manager(SourceManager **sm)
+{
+    Source *src;
+    int i;
+
+    if (*sm == NULL) return;
+    for (i = 0; i < (*sm)->len; i++)
+    {
+        src = (*sm)->files[i];
+        release_text(src);
+        free(src->heads);
+        free(src->name);
+        free(src);
+    }
+    pthread_mutex_destroy(&(*sm)->lock);
+    free((*sm)->files);
+    free((*sm)->order);
+    free(*sm);
+    *sm = NULL;
+}
+
+/*
+ * Loads the file f and returns its id, or -1.
+ * Regular files are mapped, anything else (pipes, ttys) is read.
+ */
+int
+load_source(SourceManager *sm, const char *f)
+{
+    Source *src;
+    struct stat st;
+    int fd;
+    bool ret;
+
+    fd = open(f, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("open");
+        return -1;
+    }
+    src = (Source*)try_malloc(sizeof(Source));
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        ret = map_source(src, fd, st.st_size) || read_source(src, fd);
+    }
+    else
+    {
+        ret = read_source(src, fd);
+    }
+    close(fd);
+    if (!ret)
+    {
+        free(src);
+        return -1;
+    }
+    init_window(src);
+    return add_source(sm, src, f);
+}
+
+/*
+ * Opens the stream fd as a file named name and returns its id, or -1.
+ * Its text is read by refill_source(). The locations of a stream reach
+ * up to its end, so no other file can be loaded before it ends.
+ */
+int
+open_stream(SourceManager *sm, int fd, const char *name)
+{
+    Source *src = (Source*)try_malloc(sizeof(Source));
+
+    src->size = STREAM_WINDOW;
+    src->text = (char*)try_calloc(src->size + SCAN_PADDING, 1);
+    src->len = 0;
+    src->mapsize = 0;
+    init_window(src);
+    src->fd = fd;
+    src->eof = false;
+    return add_source(sm, src, name);
+}
+
+/*
+ * Drops the text of the stream id before keep, which is in its window,
+ * and reads the stream until the window is full, or to its end.
+ * The window is only enlarged if more than half of it is kept, which
+ * is when a lexeme is longer than that.
+ * Returns the new text of the window, its length, its base and whether
+ * the stream has ended.
+ */
+const char *
+refill_source(SourceManager *sm, int id, const char *keep, size_t *len, SrcLoc *base, bool *eof)
+{
+    Source *src;
+    size_t drop, n;
+    ssize_t r;
+    const char *p;
+
+    pthread_mutex_lock(&sm->lock);
+    src = sm->files[id];
+    pthread_mutex_unlock(&sm->lock);
+
+    drop = keep - src->text;
+    n = index_lines(src->text, drop, NULL);
+    if (n > 0)
+    {
+        p = src->text + drop;
+        while (p[-1] != '\n') p--;
+        src->winline += n;
+        src->winhead = src->winoff + (p - src->text);
+    }
+    memmove(src->text, keep, src->len - drop);
+    src->len -= drop;
+    src->winoff += drop;
+    if (src->len > src->size / 2)
+    {
+        src->size *= 2;
+        src->text = (char*)try_realloc(src->text, src->size + SCAN_PADDING);
+    }
+
+    while (!src->eof && src->len < src->size)
+    {
+        r = read(src->fd, src->text + src->len, src->size - src->len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) perror("read");
+        if (r <= 0)
+        {
+            src->eof = true;
+            break;
+        }
+        src->len += r;
+        if (src->base + src->winoff + src->len >= LOC_LIMIT)
+        {
+            fprintf(stderr, "%s: Too many bytes of sources.\n", src->name);
+            src->len = LOC_LIMIT - 1 - src->base - src->winoff;
+            src->eof = true;
+        }
+    }
+    memset(src->text + src->len, '\0', SCAN_PADDING);
+
+    pthread_mutex_lock(&sm->lock);
+    free(src->heads);
+    src->heads = NULL;
+    src->nheads = 0;
+    src->indexed = false;
+    if (src->eof) sm->next = (unsigned long long)src->base + src->winoff + src->len + 1;
+    pthread_mutex_unlock(&sm->lock);
+
+    *len = src->len;
+    *base = src->base + (SrcLoc)src->winoff;
+    *eof = src->eof;
+    return src->text;
+}
+
+/* Returns the text of the file id, its length and its base */
+const char *
+source_text(SourceManager *sm, int id, size_t *len, SrcLoc *base)
+{
+    Source *src;
+
+    pthread_mutex_lock(&sm->lock);
+    src = sm->files[id];
+    pthread_mutex_unlock(&sm->lock);
+    *len = src->len;
+    *base = src->base + (SrcLoc)src->winoff;
+    return src->text;
+}
+
+/*
+ * Replaces the len bytes at off of the file id by the n bytes at text,
+ * which may lie in the file itself. The old text is freed, so
+ * source_text() must be called again, and so are the locations of the
+ * file unless its base is unchanged.
+ * Returns false if the range is not in the file or the locations are
+ * exhausted.
+ */
+bool
+edit_source(SourceManager *sm, int id, size_t off, size_t len, const char *text, size_t n)
+{
+    Source *src;
+    size_t newlen;
+    char *p;
+    int i;
+
+    pthread_mutex_lock(&sm->lock);
+    src = sm->files[id];
+    if (src->fd >= 0 || off > src->len || len > src->len - off)
+    {
+        pthread_mutex_unlock(&sm->lock);
+        return false;
+    }
+    newlen = src->len - len + n;
+
+    i = find_order(sm, src->base);
+    if (i + 1 == sm->len)
+    {
+        if (src->base + newlen >= LOC_LIMIT) goto exhausted;
+        sm->next = src->base + newlen + 1;
+    }
+    else if (src->base + newlen + 1 > sm->order[i+1]->base)
+    {
+        if (sm->next + newlen >= LOC_LIMIT) goto exhausted;
+        memmove(sm->order + i, sm->order + i + 1, sizeof(Source*) * (sm->len - i - 1));
+        sm->order[sm->len-1] = src;
+        src->base = (SrcLoc)sm->next;
+        sm->next += newlen + 1;
+    }
+
+    p = (char*)try_malloc(newlen + SCAN_PADDING);
+    memcpy(p, src->text, off);
+    memcpy(p + off, text, n);
+    memcpy(p + off + n, src->text + off + len, src->len - off - len);
+    memset(p + newlen, '\0', SCAN_PADDING);
+    release_text(src);
+    src->text = p;
+    src->len = newlen;
+    src->mapsize = 0;
+    free(src->heads);
+    src->heads = NULL;
+    src->nheads = 0;
+    src->indexed = false;
+    pthread_mutex_unlock(&sm->lock);
+    return true;
+
+exhausted:
+    pthread_mutex_unlock(&sm->lock);
+    fprintf(stderr, "%s: Too many bytes of sources.\n", src->name);
+    return false;
+}
+
+/*
+ * Returns the name of the file of loc and sets its line and column,
+ * both counted from 1. NULL is returned for a location of no file, or
+ * one which has left the window of a stream.
+ */
+const char *
+decode_loc(SourceManager *sm, SrcLoc loc, unsigned int *line, unsigned int *col)
+{
+    Source *src;
+    size_t off, lo, hi, mid;
+
+    pthread_mutex_lock(&sm->lock);
+    src = find_source(sm, loc);
+    if (src == NULL)
+    {
+        pthread_mutex_unlock(&sm->lock);
+        *line = *col = 0;
+        return NULL;
+    }
+    if (!src->indexed)
+    {
+        src->nheads = index_lines(src->text, src->len, NULL);
+        src->heads = (unsigned int*)try_malloc(sizeof(unsigned int) * (src->nheads + 1));
+        index_lines(src->text, src->len, src->heads);
+        src->indexed = true;
+    }
+    pthread_mutex_unlock(&sm->lock);
+
+    // the number of heads at or before off
+    off = loc - src->base;
+    for (lo = 0, hi = src->nheads; lo < hi; )
+    {
+        mid = lo + (hi - lo) / 2;
+        if (src->winoff + src->heads[mid] <= off) lo = mid + 1; else hi = mid;
+    }
+    *line = src->winline + (unsigned int)lo;
+    *col = (unsigned int)(off - (lo > 0 ? src->winoff + src->heads[lo-1] : src->winhead) + 1);
+    return src->name;
+}
+
+/* The index in order of the last file whose base is at or before loc, or -1 */
+static int
+find_order(const SourceManager *sm, SrcLoc loc)
+{
+    int lo = 0, hi = sm->len, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (sm->order[mid]->base <= loc) lo = mid + 1; else hi = mid;
+    }
+    return lo - 1;
+}
+
+static Source *
+find_source(const SourceManager *sm, SrcLoc loc)
+{
+    int i = find_order(sm, loc);
+    Source *src;
+
+    if (i < 0) return NULL;
+    src = sm->order[i];
+    if (loc - src->base < src->winoff) return NULL;
+    return (loc - src->base - src->winoff <= src->len) ? src : NULL;
+}
+
+/* The whole text of a file is in its window */
+static void
+init_window(Source *src)
+{
+    src->heads = NULL;
+    src->nheads = 0;
+    src->indexed = false;
+    src->fd = -1;
+    src->eof = true;
+    src->winoff = 0;
+    src->winline = 1;
+    src->winhead = 0;
+}
+
+static int
+add_source(SourceManager *sm, Source *src, const char *name)
+{
+    int id;
+
+    src->name = (char*)try_malloc(strlen(name) + 1);
+    strcpy(src->name, name);
+
+    pthread_mutex_lock(&sm->lock);
+    if (sm->next + src->len >= LOC_LIMIT)
+    {
+        pthread_mutex_unlock(&sm->lock);
+        fprintf(stderr, "%s: Too many bytes of sources.\n", name);
+        release_text(src);
+        free(src->name);
+        free(src);
+        return -1;
+    }
+    src->base = (SrcLoc)sm->next;
+    sm->next = (src->fd >= 0) ? LOC_LIMIT : sm->next + src->len + 1;
+    if (sm->len == sm->size)
+    {
+        sm->size *= 2;
+        sm->files = (Source**)try_realloc(sm->files, sizeof(Source*) * sm->size);
+        sm->order = (Source**)try_realloc(sm->order, sizeof(Source*) * sm->size);
+    }
+    id = sm->len++;
+    sm->files[id] = src;
+    sm->order[id] = src;
+    pthread_mutex_unlock(&sm->lock);
+    return id;
+}
+
+static void
+release_text(Source *src)
+{
+    if (src->mapsize > 0)
+    {
+        if (munmap(src->text, src->mapsize) != 0) perror("munmap");
+    }
+    else
+    {
+        free(src->text);
+    }
+}
+
+static bool
+map_source(Source *src, int fd, size_t size)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    size_t mapsize = ((size + SCAN_PADDING) / pagesize + 1) * pagesize;
+    char *p;
+
+    /*
+     * Reserve zero-filled pages for the file and its padding and map
+     * the file over them, so the sentinel exists even if the file
+     * size is a multiple of the page size.
+     */
+    p = mmap(NULL, mapsize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return false;
+    if (mmap(p, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(p, mapsize);
+        return false;
+    }
+    src->text = p;
+    src->len = size;
+    src->mapsize = mapsize;
+    return true;
+}
+
+static bool
+read_source(Source *src, int fd)
+{
+    size_t len = 0, size = READ_CHUNK;
+    ssize_t n;
+    char *p;
+
+    p = (char*)try_malloc(size);
+    for (;;)
+    {
+        if (size - len <= SCAN_PADDING)
+        {
+            size *= 2;
+            p = (char*)try_realloc(p, size);
+        }
+        n = read(fd, p + len, size - len - SCAN_PADDING);
+        if (n == 0) break;
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0)
+        {
+            perror("read");
+            free(p);
+            return false;
+        }
+        len += n;
+    }
+    memset(p + len, '\0', SCAN_PADDING);
+    src->text = p;
+    src->len = len;
+    src->mapsize = 0;
+    return true;
+}
@@ -1,19 +1,59 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#ifdef TEST_STRING
+#include <time.h>
+#endif
 #include "tilde.h"
 
-#define INIT_LEN (16)
+/*
+ * A string is one allocation while it is shorter than STRING_INLINE,
+ * which most spellings are: its bytes are in buf of the String itself.
+ * Beyond that they get a buffer of their own, which doubles when it is
+ * too small, so that building a long string one piece at a time copies
+ * each byte only a few times whatever the pieces are.
+ */
+#define BUILDER_BLOCK (64*1024) // bytes of a block of a builder
+#define FLUSH_IOV     (64)      // blocks written by one writev()
 
-static void realloc_string(String *string, int newsize);
+static void grow_string(String *string, size_t size);
+
+/*
+ * A builder keeps its text in a list of large blocks, which are never
+ * moved: megabytes of text are put together without copying any of it
+ * again, and written with one writev() for many blocks. The blocks
+ * stay with the builder after it is flushed, to be filled again.
+ */
+typedef struct Block
+{
+    struct Block *next;
+    size_t len;
+    size_t size;
+    char bytes[];
+} Block;
+
+struct StrBuilder
+{
+    Block *head;
+    Block *tail; /* the block text is appended to; those after it are empty */
+    size_t len;  /* of all the text */
+};
+
+static Block *next_block(StrBuilder *b, size_t size);
 
 String *
 make_string()
 {
     String *string = (String*)try_malloc(sizeof(String));
-    string->str = (char*)try_malloc(sizeof(char)*INIT_LEN);
+    string->str = string->buf;
+    string->str[0] = '\0';
     string->len = 0;
-    string->size = INIT_LEN;
+    string->size = STRING_INLINE;
+    string->hash = 0;
     return string;
 }
 
@@ -33,24 +73,51 @@ new2_string(const char *str)
     return string;
 }
 
+String *
+new3_string(const char *str, size_t len)
+{
+    String *string = make_string();
+    reserve_string(string, len);
+    memcpy(string->str, str, len);
+    string->str[len] = '\0';
+    string->len = len;
+    return string;
+}
+
+/* Copies the bytes of a view, which strings are made of only this way */
+String *
+new4_string(StrView str)
+{
+    String *string = new3_string(str.str, str.len);
+    string->hash = str.hash;
+    return string;
+}
+
 void
 free_string(String **string)
 {
     if (*string == NULL) return;
-    free((*string)->str);
+    if ((*string)->str != (*string)->buf) free((*string)->str);
     free(*string);
     *string = NULL;
 }
 
+/* Makes room for the string to grow to len bytes without reallocating */
+void
+reserve_string(String *string, size_t len)
+{
+    if (string->size <= len) grow_string(string, len + 1);
+}
+
 void
 append_string(String *dst, const String *src)
 {
-    int i;
+    size_t i;
     char *s, *d;
 
-    if (dst->size <= (dst->len + src->len + 1))
+    if (dst->size <= (dst->len + src->len))
     {
-        realloc_string(dst, dst->size + src->len + 1);
+        grow_string(dst, dst->len + src->len + 1);
     }
 
     s = src->str;
@@ -58,63 +125,364 @@ append_string(String *dst, const String *src)
     for (i = 0; i < src->len; ++i) *d++ = *s++;
     *d = '\0';
     dst->len += src->len;
+    dst->hash = 0;
 }
 
 void
 append2_string(String *dst, char c)
 {
-    if (dst->size <= (dst->len + 2))
+    if (dst->size <= (dst->len + 1))
     {
-        realloc_string(dst, dst->size + INIT_LEN);
+        grow_string(dst, dst->len + 2);
     }
 
     *(dst->str+dst->len) = c;
     *(dst->str+dst->len+1) = '\0';
     dst->len++;
+    dst->hash = 0;
 }
 
 void
 append3_string(String *dst, const char *src)
 {
-    int len;
+    size_t len;
     char *d;
 
     len = strlen(src);
-    if (dst->size <= (dst->len + len + 1))
+    if (dst->size <= (dst->len + len))
     {
-        realloc_string(dst, dst->size + len + 1);
+        grow_string(dst, dst->len + len + 1);
     }
 
     d = dst->str + dst->len;
     while (*src != '\0') *d++ = *src++;
     *d = '\0';
     dst->len += len;
+    dst->hash = 0;
+}
+
+/* Views are read without copying; a view lives no longer than its bytes */
+StrView
+view_string(const String *str)
+{
+    return (StrView){ str->str, str->len, str->hash };
+}
+
+StrView
+view2_string(const char *str)
+{
+    return (StrView){ str, strlen(str), 0 };
+}
+
+StrView
+view3_string(const char *str, size_t len)
+{
+    return (StrView){ str, len, 0 };
 }
 
 int
 cmp_string(const String *s1, const String *s2)
 {
-    return strcmp(s1->str, s2->str);
+    if (s1 == s2) return 0;
+    return cmp_view(view_string(s1), view_string(s2));
 }
 
 int
 cmp2_string(const String *s1, const char *s2)
 {
-    return strcmp(s1->str, s2);
+    return cmp_view(view_string(s1), view2_string(s2));
+}
+
+int
+cmp3_string(const String *s1, StrView s2)
+{
+    return cmp_view(view_string(s1), s2);
 }
 
+/* Orders as strcmp() does, but a '\0' is a byte like any other */
+int
+cmp_view(StrView s1, StrView s2)
+{
+    int r = memcmp(s1.str, s2.str, (s1.len < s2.len) ? s1.len : s2.len);
+
+    if (r != 0) return r;
+    return (s1.len < s2.len) ? -1 : (s1.len > s2.len);
+}
+
+/*
+ * Views of different lengths or, when both know theirs, of different
+ * hashes are told apart without reading their bytes; the bytes of the
+ * rest go to memcmp(), which the C library has vectorized.
+ */
+bool
+eq_view(StrView s1, StrView s2)
+{
+    if (s1.len != s2.len) return false;
+    if (s1.hash != 0 && s2.hash != 0 && s1.hash != s2.hash) return false;
+    return memcmp(s1.str, s2.str, s1.len) == 0;
+}
+
+/* The hash of the string, which is computed once until it changes */
+unsigned int
+hash_string(String *str)
+{
+    if (str->hash == 0) str->hash = hash_view(view_string(str));
+    return str->hash;
+}
+
+/* The hash the view carries, or else that of its bytes; never 0, which means no hash yet */
+unsigned int
+hash_view(StrView str)
+{
+    // FNV-1a Hash
+    unsigned int hash = 2166136261u;
+    size_t i;
+
+    if (str.hash != 0) return str.hash;
+    for (i = 0; i < str.len; ++i)
+    {
+        hash = (hash ^ (unsigned char)str.str[i]) * 16777619u;
+    }
+    return (hash != 0) ? hash : 1;
+}
+
+/* Gives the string a buffer of at least size bytes, doubling the one it has */
 static void
-realloc_string(String *string, int newsize)
+grow_string(String *string, size_t size)
 {
-    string->str = (char*)try_realloc(string->str, sizeof(char)*newsize);
+    size_t newsize = string->size;
+
+    while (newsize < size) newsize *= 2;
+    if (string->str == string->buf)
+    {
+        string->str = (char*)try_malloc(sizeof(char)*newsize);
+        memcpy(string->str, string->buf, string->len + 1);
+    }
+    else
+    {
+        string->str = (char*)try_realloc(string->str, sizeof(char)*newsize);
+    }
     string->size = newsize;
 }
 
+StrBuilder *
+make_builder()
+{
+    StrBuilder *b = (StrBuilder*)try_malloc(sizeof(StrBuilder));
+    b->head = b->tail = (Block*)try_malloc(sizeof(Block) + BUILDER_BLOCK);
+    b->head->next = NULL;
+    b->head->len = 0;
+    b->head->size = BUILDER_BLOCK;
+    b->len = 0;
+    return b;
+}
+
+void
+free_builder(StrBuilder **b)
+{
+    Block *t;
+
+    if (*b == NULL) return;
+    while ((t = (*b)->head) != NULL)
+    {
+        (*b)->head = t->next;
+        free(t);
+    }
+    free(*b);
+    *b = NULL;
+}
+
+void
+append_builder(StrBuilder *b, StrView s)
+{
+    Block *t = b->tail;
+    size_t n;
+
+    b->len += s.len;
+    for (;;)
+    {
+        n = t->size - t->len;
+        if (n > s.len) n = s.len;
+        memcpy(t->bytes + t->len, s.str, n);
+        t->len += n;
+        s.str += n;
+        s.len -= n;
+        if (s.len == 0) break;
+        t = next_block(b, 0);
+    }
+}
+
+void
+append2_builder(StrBuilder *b, char c)
+{
+    Block *t = b->tail;
+
+    if (t->len == t->size) t = next_block(b, 0);
+    t->bytes[t->len++] = c;
+    b->len++;
+}
+
+void
+append3_builder(StrBuilder *b, const char *s)
+{
+    append_builder(b, view2_string(s));
+}
+
+/* Appends the text printf() would print; it does not cross blocks */
+void
+format_builder(StrBuilder *b, const char *fmt, ...)
+{
+    va_list list;
+    Block *t = b->tail;
+    int n;
+
+    va_start(list, fmt);
+    n = vsnprintf(t->bytes + t->len, t->size - t->len, fmt, list);
+    va_end(list);
+    if (n < 0) return;
+    if ((size_t)n >= t->size - t->len)
+    {
+        t = next_block(b, (size_t)n + 1);
+        va_start(list, fmt);
+        vsnprintf(t->bytes, t->size, fmt, list);
+        va_end(list);
+    }
+    t->len += n;
+    b->len += n;
+}
+
+size_t
+len_builder(const StrBuilder *b)
+{
+    return b->len;
+}
+
+/* Writes all the text to fd and empties the builder, or returns false */
+bool
+flush_builder(StrBuilder *b, int fd)
+{
+    struct iovec iov[FLUSH_IOV];
+    Block *t = b->head, *end = b->tail->next;
+    bool ok = true;
+    ssize_t r;
+    int i, n;
+
+    while (ok && t != end)
+    {
+        for (n = 0; n < FLUSH_IOV && t != end; t = t->next)
+        {
+            if (t->len == 0) continue;
+            iov[n].iov_base = t->bytes;
+            iov[n].iov_len = t->len;
+            n++;
+        }
+        for (i = 0; i < n; )
+        {
+            r = writev(fd, iov + i, n - i);
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0)
+            {
+                perror("writev");
+                ok = false;
+                break;
+            }
+            // past the blocks which are written, into the one which is not yet
+            for (; i < n && (size_t)r >= iov[i].iov_len; ++i) r -= iov[i].iov_len;
+            if (i < n)
+            {
+                iov[i].iov_base = (char*)iov[i].iov_base + r;
+                iov[i].iov_len -= r;
+            }
+        }
+    }
+
+    for (t = b->head; t != end; t = t->next) t->len = 0;
+    b->tail = b->head;
+    b->len = 0;
+    return ok;
+}
+
+/* Moves the builder on to an empty block of at least size bytes */
+static Block *
+next_block(StrBuilder *b, size_t size)
+{
+    Block *t = b->tail->next;
+
+    if (t == NULL || t->size < size)
+    {
+        if (size < BUILDER_BLOCK) size = BUILDER_BLOCK;
+        t = (Block*)try_malloc(sizeof(Block) + size);
+        t->size = size;
+        t->next = b->tail->next;
+        b->tail->next = t;
+    }
+    t->len = 0;
+    b->tail = t;
+    return t;
+}
+
 #ifdef TEST_STRING
+#define BENCH_BYTES (64*1024*1024) // built for each length and way
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Builds strings of len bytes a byte at a time, as a lexer builds a literal */
+static double
+bench(size_t len, int how)
+{
+    size_t i, n, size, used;
+    String *str;
+    char *p;
+    double t = now();
+
+    for (n = BENCH_BYTES / len; n > 0; n--)
+    {
+        if (how == 0)
+        {
+            // the growth by a fixed step strings had before
+            p = NULL;
+            size = used = 0;
+            for (i = 0; i < len; ++i)
+            {
+                if (size <= used + 2) p = (char*)try_realloc(p, size += 16);
+                p[used++] = 'x';
+                p[used] = '\0';
+            }
+            free(p);
+            continue;
+        }
+        str = make_string();
+        if (how == 2) reserve_string(str, len);
+        for (i = 0; i < len; ++i) append2_string(str, 'x');
+        free_string(&str);
+    }
+    return (now() - t) * 1e9 / (double)(BENCH_BYTES / len * len);
+}
+
 int
 main(int argc, char *argv[])
 {
+    static const size_t lengths[] = { 16, 256, 4096, 65536, 1024*1024, 16*1024*1024 };
     String *str, *str2;
+    int i;
+
+    // with -b, print ns per byte of long literals for fixed steps, doubling and reserve_string()
+    if (argc > 1 && strcmp(argv[1], "-b") == 0)
+    {
+        printf("%10s %8s %8s %8s\n", "length", "step", "double", "reserve");
+        for (i = 0; i < (int)(sizeof(lengths) / sizeof(lengths[0])); ++i)
+        {
+            printf("%10zu %8.2f %8.2f %8.2f\n", lengths[i],
+                   bench(lengths[i], 0), bench(lengths[i], 1), bench(lengths[i], 2));
+        }
+        return EXIT_SUCCESS;
+    }
 
     str = make_string();
     append2_string(str, 'a'); printf("%s\n", str->str);
@@ -129,6 +497,71 @@ main(int argc, char *argv[])
 
     free_string(&str);
     free_string(&str2);
+
+    // if correct, print hello
+    str = new3_string("hello world", 5); printf("%s\n", str->str);
+    free_string(&str);
+
+    // if correct, print -1 0 1
+    str = new2_string("abc");
+    printf("%d %d %d\n", cmp3_string(str, view3_string("abcd", 4)),
+           cmp3_string(str, view3_string("abcd", 3)), cmp2_string(str, "ab"));
+
+    // a hash is kept until the string changes; if correct, print 1 0 1
+    str2 = new2_string("abc");
+    hash_string(str);
+    hash_string(str2);
+    printf("%d", eq_view(view_string(str), view_string(str2)));
+    append2_string(str2, 'd');
+    printf(" %d", eq_view(view_string(str), view_string(str2)) ||
+           hash_string(str2) != hash_view(view2_string("abcd")));
+    printf(" %d\n", eq_view(view_string(str2), view3_string("abcde", 4)));
+    free_string(&str);
+    free_string(&str2);
+
+    // a builder writes what it is given across blocks, again after a flush; if correct, print 0
+    {
+        StrBuilder *b = make_builder();
+        FILE *f = tmpfile();
+        char *p;
+        size_t n;
+        int failed = 0, round;
+
+        for (round = 0; round < 2; ++round)
+        {
+            str = make_string();
+            for (i = 0; i < 20000; ++i)
+            {
+                char line[32];
+                snprintf(line, sizeof(line), "node_%d -> node_%d;\n", i, i / 2);
+                format_builder(b, "node_%d -> node_%d;\n", i, i / 2);
+                append3_string(str, line);
+                append2_builder(b, 'x');
+                append2_string(str, 'x');
+                if (i % 5000 == 0)
+                {
+                    // longer than a block
+                    p = (char*)try_malloc(200000);
+                    memset(p, 'a' + round, 200000);
+                    append_builder(b, view3_string(p, 200000));
+                    format_builder(b, "%.*s", 100000, p);
+                    for (n = 0; n < 300000; ++n) append2_string(str, p[0]);
+                    free(p);
+                }
+            }
+            if (len_builder(b) != str->len) failed++;
+            rewind(f);
+            if (ftruncate(fileno(f), 0) != 0 || !flush_builder(b, fileno(f)) || len_builder(b) != 0) failed++;
+            p = (char*)try_malloc(str->len + 1);
+            rewind(f);
+            if (fread(p, 1, str->len + 1, f) != str->len || memcmp(p, str->str, str->len) != 0) failed++;
+            free(p);
+            free_string(&str);
+        }
+        fclose(f);
+        free_builder(&b);
+        printf("%d\n", failed);
+    }
     
     return EXIT_SUCCESS;
 }
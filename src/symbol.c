@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "tilde.h"
+
+#define SHARD_BITS  (6)
+#define NSHARDS     (1 << SHARD_BITS)
+#define BLOCK_BITS  (8)                 /* of the size of the first block */
+#define MAX_BLOCKS  (32 - BLOCK_BITS)
+
+/*
+ * The interner gives every spelling a number of its own, so that two
+ * identifiers are the same if their symbols are, and each spelling is
+ * stored once however often it is written.
+ * Symbols are never freed; SYM_NONE is no spelling.
+ * The value of a numeric constant, and the literal of a string
+ * literal, are kept beside its spelling, as they depend on nothing else.
+ *
+ * The table is shared by all lexers of the process and may be used
+ * from any thread. So that lexers on separate threads seldom wait for
+ * each other, it is split in shards by the high bits of the hash of a
+ * spelling, each with a lock of its own. A symbol is the number of its
+ * entry in the shard, counted from 1, followed by SHARD_BITS of the
+ * shard. The entries of a shard are kept in blocks which are never
+ * moved, the first of 1 << BLOCK_BITS entries and each next twice as
+ * long, so the spelling of a symbol is read without a lock.
+ */
+typedef struct
+{
+    String *name;     /* owned by the table of the shard */
+    Number number;    /* NT_NONE if none */
+    Literal literal;  /* LIT_NONE if none */
+} Entry;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    Hashmap *table;             /* spelling -> symbol */
+    Entry *blocks[MAX_BLOCKS];
+    unsigned int n;             /* entries */
+} Shard;
+
+static Shard shards[NSHARDS];
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static void
+init_shards()
+{
+    int i;
+
+    for (i = 0; i < NSHARDS; i++) pthread_mutex_init(&shards[i].lock, NULL);
+}
+
+/* Returns the entry of sym, or NULL for SYM_NONE */
+static Entry *
+lookup(Symbol sym)
+{
+    Shard *sh = &shards[sym & (NSHARDS - 1)];
+    unsigned int i = (sym >> SHARD_BITS) - 1 + (1u << BLOCK_BITS);
+    int k;
+
+    if (sym >> SHARD_BITS == 0) return NULL;
+    k = 31 - __builtin_clz(i);
+    if (sh->blocks[k - BLOCK_BITS] == NULL) return NULL;
+    return &sh->blocks[k - BLOCK_BITS][i - (1u << k)];
+}
+
+/* Returns the symbol of the len bytes at s */
+Symbol
+intern(const char *s, size_t len)
+{
+    StrView v = view3_string(s, len);
+    Shard *sh;
+    Entry *e;
+    String *key;
+    Symbol sym;
+    unsigned int i;
+    int k;
+
+    pthread_once(&once, init_shards);
+    // hashed once, for the shard, the lookup and the key it may add
+    v.hash = hash_view(v);
+    sh = &shards[v.hash >> (32 - SHARD_BITS)];
+    pthread_mutex_lock(&sh->lock);
+    if (sh->table == NULL) sh->table = make_hashmap(1 << BLOCK_BITS);
+    sym = (Symbol)(uintptr_t)search_hashmap(sh->table, v);
+    if (sym == SYM_NONE)
+    {
+        i = sh->n + (1u << BLOCK_BITS);
+        k = 31 - __builtin_clz(i) - BLOCK_BITS;
+        if (sh->blocks[k] == NULL)
+        {
+            sh->blocks[k] = (Entry*)try_malloc(sizeof(Entry) << (k + BLOCK_BITS));
+        }
+        sym = (++sh->n << SHARD_BITS) | (Symbol)(sh - shards);
+        key = new4_string(v);
+        add2_hashmap(sh->table, key, (void*)(uintptr_t)sym);
+        e = lookup(sym);
+        e->name = key;
+        e->number.type = NT_NONE;
+        e->literal = LIT_NONE;
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return sym;
+}
+
+Symbol
+intern2(const char *s)
+{
+    return intern(s, strlen(s));
+}
+
+/*
+ * Returns the spelling of sym, or NULL for SYM_NONE. Whoever has sym
+ * got it from intern(), so its entry was filled before, and a name is
+ * never changed: no lock is needed.
+ */
+const String *
+symbol_string(Symbol sym)
+{
+    Entry *e = lookup(sym);
+
+    return (e == NULL) ? NULL : e->name;
+}
+
+/* Gets the value of the constant sym, if it has been given one */
+bool
+symbol_number(Symbol sym, Number *n)
+{
+    Shard *sh = &shards[sym & (NSHARDS - 1)];
+    Entry *e = lookup(sym);
+    bool ret;
+
+    if (e == NULL) return false;
+    pthread_mutex_lock(&sh->lock);
+    ret = (e->number.type != NT_NONE);
+    if (ret) *n = e->number;
+    pthread_mutex_unlock(&sh->lock);
+    return ret;
+}
+
+void
+set_symbol_number(Symbol sym, const Number *n)
+{
+    Shard *sh = &shards[sym & (NSHARDS - 1)];
+    Entry *e = lookup(sym);
+
+    if (e == NULL) return;
+    pthread_mutex_lock(&sh->lock);
+    e->number = *n;
+    pthread_mutex_unlock(&sh->lock);
+}
+
+/* Returns the literal of the string literal sym, or LIT_NONE if not given one */
+Literal
+symbol_literal(Symbol sym)
+{
+    Shard *sh = &shards[sym & (NSHARDS - 1)];
+    Entry *e = lookup(sym);
+    Literal lit;
+
+    if (e == NULL) return LIT_NONE;
+    pthread_mutex_lock(&sh->lock);
+    lit = e->literal;
+    pthread_mutex_unlock(&sh->lock);
+    return lit;
+}
+
+void
+set_symbol_literal(Symbol sym, Literal lit)
+{
+    Shard *sh = &shards[sym & (NSHARDS - 1)];
+    Entry *e = lookup(sym);
+
+    if (e == NULL) return;
+    pthread_mutex_lock(&sh->lock);
+    e->literal = lit;
+    pthread_mutex_unlock(&sh->lock);
+}
+
+static void
+liberator_none(void *data) { }
+
+/* Frees all the symbols, whose numbers may be given again afterwards */
+void
+free_symbols()
+{
+    Shard *sh;
+    int k;
+
+    pthread_once(&once, init_shards);
+    for (sh = shards; sh < shards + NSHARDS; sh++)
+    {
+        pthread_mutex_lock(&sh->lock);
+        if (sh->table != NULL) free_hashmap(&sh->table, liberator_none);
+        for (k = 0; k < MAX_BLOCKS; k++)
+        {
+            free(sh->blocks[k]);
+            sh->blocks[k] = NULL;
+        }
+        sh->n = 0;
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
@@ -5,14 +5,33 @@ typedef int bool;
 #define true (1)
 #define false (0)
 
+#define STRING_INLINE (24) // strings shorter than this need no buffer of their own
+
 typedef struct
 {
-    char *str;
-    int len;
-    int size;
+    char *str;                 /* buf while the string fits in it */
+    size_t len;
+    size_t size;
+    unsigned int hash;         /* of the bytes, or 0 until hash_string() */
+    char buf[STRING_INLINE];
 } String;
 
+/* The len bytes at str, which belong to someone else and need no '\0' */
+typedef struct
+{
+    const char *str;
+    size_t len;
+    unsigned int hash; /* of the bytes, or 0 if not known */
+} StrView;
+
+typedef unsigned int SrcLoc; // base of a file plus an offset in it
+typedef unsigned int Symbol; // number of an interned spelling
+typedef unsigned int Literal; // number of a decoded string literal
+
 typedef struct Hashmap Hashmap;
+typedef struct StrBuilder StrBuilder;
+typedef struct Lexer Lexer;
+typedef struct SourceManager SourceManager;
 
 struct List_body;
 typedef struct
@@ -27,6 +46,38 @@ typedef struct
     struct List_body *p;
 } iter_list;
 
+typedef struct
+{
+    void **v;
+    int len;
+    int size;
+} Vec;
+
+typedef struct
+{
+    const Vec *vec;
+    int i;
+} iter_vec;
+
+#define SMALL_VEC (4) // elements a SmallVec holds in itself
+
+typedef struct
+{
+    int len;
+    int size;          /* SMALL_VEC until heap is used */
+    union
+    {
+        void *in[SMALL_VEC];
+        void **heap;
+    };
+} SmallVec;
+
+typedef struct
+{
+    const SmallVec *vec;
+    int i;
+} iter_smallvec;
+
 enum TokenKind
 {
     TK_INVALID,
@@ -93,15 +144,129 @@ enum PnctID
     P_ASGN_VBAR,
 };
 
+enum KeywordID
+{
+    KW_INVALID,
+
+    KW_BOOL,
+    KW_BREAK,
+    KW_CASE,
+    KW_CHAR,
+    KW_CONST,
+    KW_CONTINUE,
+    KW_DEFAULT,
+    KW_DO,
+    KW_DOUBLE,
+    KW_ELSE,
+    KW_ENUM,
+    KW_EXTERN,
+    KW_FALSE,
+    KW_FLOAT,
+    KW_FOR,
+    KW_GOTO,
+    KW_IF,
+    KW_INLINE,
+    KW_INT,
+    KW_LONG,
+    KW_RETURN,
+    KW_SHORT,
+    KW_SIZEOF,
+    KW_STATIC,
+    KW_STRUCT,
+    KW_SWITCH,
+    KW_TRUE,
+    KW_TYPEDEF,
+    KW_UCHAR,
+    KW_UINT,
+    KW_ULONG,
+    KW_UNION,
+    KW_USHORT,
+    KW_VOID,
+    KW_VOLATILE,
+    KW_WHILE,
+};
+
 typedef struct
 {
     enum TokenKind kind;
     enum PnctID id;
-    String *str;
-    int row;
-    int col;
+    enum KeywordID kw;
+    String *str;     /* of a TK_STRING, may be lent by the literal pool: read only */
+    Symbol sym;
+    unsigned int row;
+    unsigned int col;
 } Token;
 
+/* Counts of the token pool of a lexer, see next_token() */
+typedef struct
+{
+    unsigned long tokens;         /* handed out by next_token() */
+    unsigned long token_allocs;   /* slabs allocated for them */
+    unsigned long freed;          /* given back by free_token() to be used again */
+    unsigned long strings;        /* spellings of the tokens */
+    unsigned long string_allocs;  /* of them, too long to be kept in the token */
+} PoolStats;
+
+/* A token which refers to its spelling in the source buffer */
+typedef struct
+{
+    enum TokenKind kind : 8;
+    enum PnctID id : 8;
+    enum KeywordID kw : 8;
+    SrcLoc loc; // of the spelling, quotes of literals included
+    unsigned int len;
+    Symbol sym; // of identifiers and literals, else SYM_NONE
+} Lexeme;
+
+enum NumType
+{
+    NT_NONE,
+    NT_INT,
+    NT_UINT,
+    NT_LONG,
+    NT_ULONG,
+    NT_FLOAT,
+    NT_DOUBLE,
+    NT_LDOUBLE, // held as a double
+};
+
+/* The value of an integer or floating constant */
+typedef struct
+{
+    enum NumType type;
+    union
+    {
+        unsigned long long i;
+        double f;
+    };
+} Number;
+
+/* What decode_number() has found wrong with a constant */
+enum NumError
+{
+    NUM_OK,
+    NUM_RANGE,      // out of the range of its type
+    NUM_MALFORMED,  // 0x without digits, or an exponent without digits
+};
+
+/* The lexemes which edit_token_array() has replaced */
+typedef struct
+{
+    int first;
+    int removed;
+    int inserted;
+} TokenEdit;
+
+/* Lexemes of a file in source order, ending with TK_ENDFILE */
+typedef struct
+{
+    Lexeme *v;
+    int len;
+    int size;
+    char *map;      // the .tok file v was loaded from, or NULL
+    size_t mapsize;
+} TokenArray;
+
 enum TypeType
 {
     TT_UNKNOWN,
@@ -130,12 +295,12 @@ typedef struct Type
         struct /* struct or union */
         {
             bool is_struct;
-            List *contents; // List<Node*>
+            Vec *contents; // Vec<Node*>
         };
         struct /* function */
         {
             struct Type *ret;
-            List *args; // List<Node*>
+            SmallVec args; // SmallVec<Node*>
             bool is_vargs;
             bool is_inline;
         };
@@ -194,15 +359,19 @@ typedef struct Node
     Type *type;
     union
     {
+        struct // identifier, constant or string literal
+        {
+            Symbol sym;
+        };
         struct // var-decl or function definition
         {
-            String *name;
+            Symbol name;
             struct Node *init_or_body;
             enum StorageClass sc;
         };
         struct // label
         {
-            String *label;
+            Symbol label;
             struct Node *label_stmt;
         };
         struct // case
@@ -216,7 +385,7 @@ typedef struct Node
         };
         struct // compound statement
         {
-            List *stmts; // List<Node*>
+            SmallVec stmts; // SmallVec<Node*>
         };
         struct // expression statement
         {
@@ -252,7 +421,7 @@ typedef struct Node
         };
         struct // goto statement
         {
-            String *goto_label;
+            Symbol goto_label;
         };
         struct // return statement
         {
@@ -263,26 +432,114 @@ typedef struct Node
 
 // parser.c
 void  init_parser(const char *file);
-List *parser_top();
+Vec *parser_top();
 
 // lex.c
-bool   open_file(const char *f);
-void   close_file();
+Lexer *make_lexer(const char *f);
+Lexer *make2_lexer(SourceManager *sm, const char *f);
+Lexer *make3_lexer(SourceManager *sm, int fd, const char *name);
+void   free_lexer(Lexer **lexer);
 void   print_token(const Token *tk);
+void   print_lexeme(const Lexer *lexer, const Lexeme *lx);
 char  *punctuator_to_string(enum PnctID p);
-Token *next_token();
+const char *keyword_to_string(enum KeywordID kw);
+void   next_lexeme(Lexer *lexer, Lexeme *lx);
+const char *lexeme_text(const Lexer *lexer, const Lexeme *lx);
+void   lexeme_position(const Lexer *lexer, const Lexeme *lx, unsigned int *row, unsigned int *col);
+Token *next_token(Lexer *lexer);
 void   free_token(Token **tk);
+void   token_pool_stats(const Lexer *lexer, PoolStats *st);
+TokenArray *make_token_array();
+void   free_token_array(TokenArray **a);
+void   add_token_array(TokenArray *a, const Lexeme *lx);
+int    fill_token_array(Lexer *lexer, TokenArray *a, int n);
+TokenArray *lex_all(Lexer *lexer);
+TokenArray *lex_parallel(Lexer *lexer, int nthreads);
+bool   save_token_array(const Lexer *lexer, const TokenArray *a, const char *f);
+TokenArray *load_token_array(Lexer *lexer, const char *f);
+TokenArray *lex_cached(Lexer *lexer, const char *f);
+bool   edit_token_array(Lexer *lexer, TokenArray *a, size_t off, size_t len, const char *text, size_t n,
+                        TokenEdit *ed);
+
+// scan.c
+#define SCAN_PADDING (64) // readable bytes required after a scanned buffer
+#define CC_SPACE    (1 << 0) // ' ', '\t', '\v'
+#define CC_RETURN   (1 << 1) // '\n', '\r'
+#define CC_NONDIGIT (1 << 2) // letters and '_'
+#define CC_DIGIT    (1 << 3)
+#define CC_OCT      (1 << 4)
+#define CC_HEX      (1 << 5)
+extern const unsigned char char_class[256];
+const char *skip_blank(const char *p);
+const char *find_comment_end(const char *p);
+const char *find_eol(const char *p);
+const char *skip_ident(const char *p);
+const char *skip_digit(const char *p, int base);
+size_t index_lines(const char *p, size_t len, unsigned int *heads);
+size_t validate_utf8(const char *p, size_t len);
+
+// source.c
+SourceManager *make_source_manager();
+void   free_source_manager(SourceManager **sm);
+int    load_source(SourceManager *sm, const char *f);
+int    open_stream(SourceManager *sm, int fd, const char *name);
+const char *refill_source(SourceManager *sm, int id, const char *keep, size_t *len, SrcLoc *base, bool *eof);
+const char *source_text(SourceManager *sm, int id, size_t *len, SrcLoc *base);
+bool   edit_source(SourceManager *sm, int id, size_t off, size_t len, const char *text, size_t n);
+const char *decode_loc(SourceManager *sm, SrcLoc loc, unsigned int *line, unsigned int *col);
+
+// symbol.c
+#define SYM_NONE (0)
+#define LIT_NONE (0)
+Symbol intern(const char *s, size_t len);
+Symbol intern2(const char *s);
+const String *symbol_string(Symbol sym);
+bool symbol_number(Symbol sym, Number *n);
+void set_symbol_number(Symbol sym, const Number *n);
+Literal symbol_literal(Symbol sym);
+void set_symbol_literal(Symbol sym, Literal lit);
+void free_symbols();
+
+// literal.c
+Literal decode_literal(const char *s, size_t len);
+Literal intern_literal(const char *s, size_t len);
+const char *literal_bytes(Literal lit, size_t *len);
+const char *literal_section(size_t *size);
+size_t literal_offset(Literal lit);
+void free_literals();
+
+// number.c
+enum NumError decode_number(const char *s, size_t len, Number *n);
 
 // string.c
 String *make_string();
 String *new_string(const String *str);
 String *new2_string(const char *str);
+String *new3_string(const char *str, size_t len);
+String *new4_string(StrView str);
+StrView view_string(const String *str);
+StrView view2_string(const char *str);
+StrView view3_string(const char *str, size_t len);
 void   free_string(String **string);
+void   reserve_string(String *string, size_t len);
 void   append_string(String *dst, const String *src);
 void   append2_string(String *dst, char c);
 void   append3_string(String *dst, const char *src);
 int    cmp_string(const String *s1, const String *s2);
 int    cmp2_string(const String *s1, const char *s2);
+int    cmp3_string(const String *s1, StrView s2);
+int    cmp_view(StrView s1, StrView s2);
+bool   eq_view(StrView s1, StrView s2);
+unsigned int hash_string(String *str);
+unsigned int hash_view(StrView str);
+StrBuilder *make_builder();
+void   free_builder(StrBuilder **b);
+void   append_builder(StrBuilder *b, StrView s);
+void   append2_builder(StrBuilder *b, char c);
+void   append3_builder(StrBuilder *b, const char *s);
+void   format_builder(StrBuilder *b, const char *fmt, ...);
+size_t len_builder(const StrBuilder *b);
+bool   flush_builder(StrBuilder *b, int fd);
 
 // list.c
 void liberator_void(void *);
@@ -297,17 +554,45 @@ bool hasnext_iter_list(const iter_list *iter);
 void next_iter_list(iter_list *iter);
 void *value_iter_list(const iter_list *iter);
 
+// vec.c
+Vec  *make_vec();
+void  free_vec(Vec **vec, void (*liberator)(void*));
+void  add_vec(Vec *vec, void *data);
+void  reserve_vec(Vec *vec, int len);
+bool  remove_vec(Vec *vec, void (*liberator)(void*), int n);
+void *at_vec(const Vec *vec, int n);
+void *pop_vec(Vec *vec);
+void  init_iter_vec(const Vec *vec, iter_vec *iter);
+bool  hasnext_iter_vec(const iter_vec *iter);
+void  next_iter_vec(iter_vec *iter);
+void *value_iter_vec(const iter_vec *iter);
+void  init_smallvec(SmallVec *vec);
+void  free_smallvec(SmallVec *vec, void (*liberator)(void*));
+void  add_smallvec(SmallVec *vec, void *data);
+void *at_smallvec(const SmallVec *vec, int n);
+void  copy_smallvec(SmallVec *dst, const SmallVec *src);
+void  init_iter_smallvec(const SmallVec *vec, iter_smallvec *iter);
+bool  hasnext_iter_smallvec(const iter_smallvec *iter);
+void  next_iter_smallvec(iter_smallvec *iter);
+void *value_iter_smallvec(const iter_smallvec *iter);
+
 // hashmap.c
 Hashmap *make_hashmap(int size);
 void free_hashmap(Hashmap **h, void (*liberator)(void*));
-bool add_hashmap(Hashmap *h, const String *key, void *data);
-bool remove_hashmap(Hashmap *h, const String *key, void (*liberator)(void*));
-bool exists_hashmap(Hashmap *h, const String *key);
-void *search_hashmap(Hashmap *h, const String *key);
+bool add_hashmap(Hashmap *h, StrView key, void *data);
+bool add2_hashmap(Hashmap *h, String *key, void *data);
+bool remove_hashmap(Hashmap *h, StrView key, void (*liberator)(void*));
+bool exists_hashmap(Hashmap *h, StrView key);
+void *search_hashmap(Hashmap *h, StrView key);
+
+// unicode.c
+int  decode_utf8(const char *p, size_t len, unsigned int *cp);
+bool is_xid_start(unsigned int cp);
+bool is_xid_continue(unsigned int cp);
 
 // error.c
-void print_error(int row, int col, const char *f, ...);
-void exit_error(int row, int col, const char *f, ...);
+void print_error(unsigned int row, unsigned int col, const char *f, ...);
+void exit_error(unsigned int row, unsigned int col, const char *f, ...);
 void malloc_error();
 void *try_malloc(size_t size);
 void *try_calloc(size_t n, size_t size);
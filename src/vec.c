@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tilde.h"
+
+#define INIT_VEC (8)
+
+/*
+ * A vector keeps its elements side by side in one array, which
+ * doubles when it is full: adding and popping at the end take
+ * amortized constant time, and any element is reached at once.
+ * It is iterated as a List is; an iterator goes by index, so
+ * elements may be added behind it.
+ *
+ * A SmallVec is kept in the node which owns it and holds its first
+ * SMALL_VEC elements itself; only a longer one goes to the heap. It
+ * points nowhere into itself, so it is moved as any other field is.
+ */
+#define ITEMS(sv) ((sv)->size > SMALL_VEC ? (sv)->heap : (void**)(sv)->in)
+
+static void grow_vec(Vec *vec, int size);
+
+Vec *
+make_vec()
+{
+    Vec *vec = (Vec*)try_malloc(sizeof(Vec));
+    vec->v = NULL;
+    vec->len = 0;
+    vec->size = 0;
+    return vec;
+}
+
+void
+free_vec(Vec **vec, void (*liberator)(void *))
+{
+    int i;
+
+    if (*vec == NULL) return;
+    for (i = 0; i < (*vec)->len; ++i) liberator((*vec)->v[i]);
+    free((*vec)->v);
+    free(*vec);
+    *vec = NULL;
+}
+
+void
+add_vec(Vec *vec, void *data)
+{
+    if (vec->len == vec->size) grow_vec(vec, vec->len + 1);
+    vec->v[vec->len++] = data;
+}
+
+/* Makes room for len elements in all */
+void
+reserve_vec(Vec *vec, int len)
+{
+    if (vec->size < len) grow_vec(vec, len);
+}
+
+bool
+remove_vec(Vec *vec, void (*liberator)(void *), int n)
+{
+    if (n < 0 || n >= vec->len) return false;
+    liberator(vec->v[n]);
+    memmove(vec->v + n, vec->v + n + 1, sizeof(void*) * (vec->len - n - 1));
+    vec->len--;
+    return true;
+}
+
+void *
+at_vec(const Vec *vec, int n)
+{
+    return (n < 0 || n >= vec->len) ? NULL : vec->v[n];
+}
+
+void *
+pop_vec(Vec *vec)
+{
+    return (vec->len == 0) ? NULL : vec->v[--vec->len];
+}
+
+void
+init_iter_vec(const Vec *vec, iter_vec *iter) { iter->vec = vec; iter->i = 0; }
+
+bool
+hasnext_iter_vec(const iter_vec *iter) { return iter->i < iter->vec->len; }
+
+void
+next_iter_vec(iter_vec *iter) { if (iter->i < iter->vec->len) iter->i++; }
+
+void *
+value_iter_vec(const iter_vec *iter) { return iter->vec->v[iter->i]; }
+
+static void
+grow_vec(Vec *vec, int size)
+{
+    int newsize = (vec->size > 0) ? vec->size : INIT_VEC;
+
+    while (newsize < size) newsize *= 2;
+    vec->v = (void**)try_realloc(vec->v, sizeof(void*) * newsize);
+    vec->size = newsize;
+}
+
+void
+init_smallvec(SmallVec *vec)
+{
+    vec->len = 0;
+    vec->size = SMALL_VEC;
+}
+
+/* Frees what the elements take on the heap, but not vec itself */
+void
+free_smallvec(SmallVec *vec, void (*liberator)(void *))
+{
+    int i;
+
+    for (i = 0; i < vec->len; ++i) liberator(ITEMS(vec)[i]);
+    if (vec->size > SMALL_VEC) free(vec->heap);
+    init_smallvec(vec);
+}
+
+void
+add_smallvec(SmallVec *vec, void *data)
+{
+    void **v;
+
+    if (vec->len == vec->size)
+    {
+        if (vec->size == SMALL_VEC)
+        {
+            v = (void**)try_malloc(sizeof(void*) * SMALL_VEC * 2);
+            memcpy(v, vec->in, sizeof(void*) * SMALL_VEC);
+        }
+        else
+        {
+            v = (void**)try_realloc(vec->heap, sizeof(void*) * vec->size * 2);
+        }
+        vec->heap = v;
+        vec->size *= 2;
+    }
+    ITEMS(vec)[vec->len++] = data;
+}
+
+void *
+at_smallvec(const SmallVec *vec, int n)
+{
+    return (n < 0 || n >= vec->len) ? NULL : ITEMS(vec)[n];
+}
+
+/* Makes dst hold the elements of src, in storage of its own */
+void
+copy_smallvec(SmallVec *dst, const SmallVec *src)
+{
+    int i;
+
+    init_smallvec(dst);
+    for (i = 0; i < src->len; ++i) add_smallvec(dst, ITEMS(src)[i]);
+}
+
+void
+init_iter_smallvec(const SmallVec *vec, iter_smallvec *iter) { iter->vec = vec; iter->i = 0; }
+
+bool
+hasnext_iter_smallvec(const iter_smallvec *iter) { return iter->i < iter->vec->len; }
+
+void
+next_iter_smallvec(iter_smallvec *iter) { if (iter->i < iter->vec->len) iter->i++; }
+
+void *
+value_iter_smallvec(const iter_smallvec *iter) { return ITEMS(iter->vec)[iter->i]; }
+
+#ifdef TEST_VEC
+void
+debug_print(const Vec *vec)
+{
+    iter_vec iter;
+
+    printf("[");
+    for (init_iter_vec(vec, &iter);
+         hasnext_iter_vec(&iter);
+         next_iter_vec(&iter))
+    {
+        printf("%s, ", (char*)value_iter_vec(&iter));
+    }
+    printf("]\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    static char *words[] = { "a", "b", "c", "d", "e", "f", "g", "h", "i", "j" };
+    Vec *vec;
+    int i;
+
+    vec = make_vec();
+    add_vec(vec, "a");
+    add_vec(vec, "b");
+    add_vec(vec, "c");
+
+    // if correct, print [a, b, c, ]
+    debug_print(vec);
+
+    // if correct, print c
+    printf("%s\n", (char*)at_vec(vec, vec->len-1));
+
+    // if correct, print c
+    printf("%s\n", (char*)pop_vec(vec));
+    // if correct, print [a, b, ]
+    debug_print(vec);
+
+    // if correct, print [b, ]
+    remove_vec(vec, liberator_void, 0);
+    debug_print(vec);
+
+    // if correct, print []
+    remove_vec(vec, liberator_void, 0);
+    debug_print(vec);
+
+    // past the first array; if correct, print [a, b, c, d, e, f, g, h, i, j, ]
+    for (i = 0; i < 10; ++i) add_vec(vec, words[i]);
+    debug_print(vec);
+
+    // if correct, print [a, b, c, e, f, g, h, i, j, ]
+    remove_vec(vec, liberator_void, 3);
+    debug_print(vec);
+
+    // if correct, print 1
+    printf("%d\n", at_vec(vec, vec->len) == NULL);
+
+    free_vec(&vec, liberator_void);
+
+    // in place, then on the heap; if correct, print a b c d e f g h i j 10
+    {
+        SmallVec sv, copy;
+        iter_smallvec iter;
+
+        init_smallvec(&sv);
+        for (i = 0; i < 10; ++i)
+        {
+            add_smallvec(&sv, words[i]);
+            if (i == SMALL_VEC - 1) copy_smallvec(&copy, &sv);
+        }
+        for (init_iter_smallvec(&sv, &iter);
+             hasnext_iter_smallvec(&iter);
+             next_iter_smallvec(&iter))
+        {
+            printf("%s ", (char*)value_iter_smallvec(&iter));
+        }
+        printf("%d\n", sv.len);
+
+        // if correct, print a d 1
+        printf("%s %s %d\n", (char*)at_smallvec(&copy, 0), (char*)at_smallvec(&copy, SMALL_VEC - 1),
+               at_smallvec(&copy, SMALL_VEC) == NULL);
+        free_smallvec(&copy, liberator_void);
+        free_smallvec(&sv, liberator_void);
+    }
+
+    return 0;
+}
+#endif